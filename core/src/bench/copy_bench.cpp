@@ -0,0 +1,81 @@
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <sys/mman.h>
+#include "parallel_copy.h"
+
+/*
+ * Scaling of the page copy of the hide over segment size and thread count.
+ *
+ * The destination is fresh anonymous memory every time, as the backup of a hide is, so page
+ * faults are part of the cost. Segments under PARALLEL_COPY_MIN are copied on the calling
+ * thread whatever the thread count.
+ *
+ * usage: copy_bench [iterations]
+ */
+
+static double now_ms() {
+    timespec ts{};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static double bench(const void *src, size_t size, int threads, int iterations) {
+    double best = 1e9;
+    for (int i = 0; i < iterations; ++i) {
+        auto dst = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (dst == MAP_FAILED) {
+            perror("mmap");
+            exit(1);
+        }
+
+        double start = now_ms();
+        hide::parallel_copy(dst, src, size, threads);
+        double time = now_ms() - start;
+        if (time < best) best = time;
+
+        if (memcmp(dst, src, size) != 0) {
+            printf("copy of %zu bytes with %d threads differs\n", size, threads);
+            exit(1);
+        }
+        munmap(dst, size);
+    }
+    return best;
+}
+
+int main(int argc, char **argv) {
+    int iterations = argc > 1 ? atoi(argv[1]) : 10;
+    if (iterations < 1) iterations = 1;
+
+    static const size_t sizes_mb[] = {1, 4, 8, 16, 64, 256};
+    static const int threads[] = {1, 2, 4, 8};
+
+    auto max_size = sizes_mb[sizeof(sizes_mb) / sizeof(sizes_mb[0]) - 1] * 1024 * 1024;
+    auto src = (char *) mmap(nullptr, max_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (src == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+    for (size_t i = 0; i < max_size; i += sizeof(uint32_t)) {
+        *(uint32_t *) (src + i) = (uint32_t) (i * 2654435761u);
+    }
+
+    printf("best of %d, ms (GB/s)\n", iterations);
+    printf("%8s", "size MB");
+    for (int t : threads) printf("  %9d thread%s", t, t == 1 ? " " : "s");
+    printf("\n");
+
+    for (auto size_mb : sizes_mb) {
+        auto size = size_mb * 1024 * 1024;
+        printf("%8zu", size_mb);
+        for (int t : threads) {
+            double ms = bench(src, size, t, iterations);
+            printf("  %7.2f (%5.1f)", ms, size / ms / 1e6);
+        }
+        printf("\n");
+    }
+    munmap(src, max_size);
+    return 0;
+}
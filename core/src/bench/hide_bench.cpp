@@ -0,0 +1,340 @@
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "hide_lazy.h"
+#include "hide_utils.h"
+#include "hide_wrap.h"
+#include "maps_snapshot.h"
+#include "wrap.h"
+
+/*
+ * Hide a synthetic library of a few megabytes mapped the way the linker does
+ * (r-x text, r-- relro, a ---p gap, rw- data), check the content and the protection
+ * survive and the path is gone from maps.
+ *
+ * Memory is the growth of the process (smaps_rollup) from before the hide to after it, the
+ * library itself is read once before. memfd pages are shmem: dirty, but not anonymous.
+ * Syscalls are those made through wrap.h.
+ *
+ * lazy is measured after touching every tenth page of the text only, then once more after
+ * lazy_finish has filled the rest (the finish row has the time of lazy_finish).
+ *
+ * usage: hide_bench [size_mb] [iterations]
+ *   the library file is created in the current directory, which should not be on tmpfs
+ */
+
+static const size_t page_size = (size_t) sysconf(_SC_PAGESIZE);
+
+static double now_ms() {
+    timespec ts{};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+struct library {
+    std::string path;
+    uintptr_t start;
+    size_t size;
+    std::vector<hide_range> segments;
+};
+
+static size_t round_page(size_t size) {
+    return (size + page_size - 1) & ~(page_size - 1);
+}
+
+static bool create_file(library &lib, size_t size) {
+    // in the current directory, pages of tmpfs files count as dirty
+    char dir[] = "riru_hide_XXXXXX";
+    char absolute[PATH_MAX];
+    if (!mkdtemp(dir) || !realpath(dir, absolute)) return false;
+    lib.path = std::string(absolute) + "/libriru_bench.so";
+
+    int fd = open(lib.path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1) return false;
+
+    lib.size = round_page(size);
+    std::vector<uint32_t> buf(page_size / sizeof(uint32_t));
+    for (size_t offset = 0; offset < lib.size; offset += page_size) {
+        for (size_t i = 0; i < buf.size(); ++i) {
+            buf[i] = (uint32_t) (offset + i * 2654435761u);
+        }
+        if (write(fd, buf.data(), page_size) != (ssize_t) page_size) return false;
+    }
+    // pages not written back yet count as dirty once mapped
+    fsync(fd);
+    close(fd);
+    return true;
+}
+
+/*
+ * Map the file like the linker: reserve, then map every segment with MAP_FIXED.
+ */
+static bool map_library(library &lib) {
+    int fd = open(lib.path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return false;
+
+    auto base = (uintptr_t) mmap(nullptr, lib.size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == (uintptr_t) MAP_FAILED) return false;
+
+    size_t text = round_page(lib.size * 6 / 10);
+    size_t relro = round_page(lib.size * 2 / 10);
+    size_t gap = page_size;
+    size_t data = lib.size - text - relro - gap;
+
+    struct {
+        size_t size;
+        int prot;
+    } layout[] = {
+            {text,  PROT_READ | PROT_EXEC},
+            {relro, PROT_READ},
+            {gap,   PROT_NONE},
+            {data,  PROT_READ | PROT_WRITE},
+    };
+
+    lib.start = base;
+    lib.segments.clear();
+    size_t offset = 0;
+    for (auto &segment : layout) {
+        if (mmap((void *) (base + offset), segment.size, segment.prot, MAP_PRIVATE | MAP_FIXED, fd, (off_t) offset) == MAP_FAILED)
+            return false;
+        lib.segments.push_back({base + offset, base + offset + segment.size, segment.prot});
+        offset += segment.size;
+    }
+    close(fd);
+
+    // dirty data like relocations do
+    memset((void *) (base + text + relro + gap), 0x5a, page_size);
+    return true;
+}
+
+static uint64_t checksum(const library &lib) {
+    uint64_t sum = 0;
+    for (auto &segment : lib.segments) {
+        if (!(segment.prot & PROT_READ)) continue;
+        for (auto p = (const uint64_t *) segment.start; p < (const uint64_t *) segment.end; ++p) {
+            sum = sum * 31 + *p;
+        }
+    }
+    return sum;
+}
+
+/*
+ * The path must be gone and every segment must keep its protection.
+ */
+static bool verify(const library &lib) {
+    maps::snapshot snapshot;
+    if (snapshot.take() == -1) return false;
+    if (snapshot.find_path(lib.path.c_str()) != maps::snapshot::NO_PATH) {
+        printf("path is still in maps\n");
+        return false;
+    }
+    for (auto &segment : lib.segments) {
+        for (size_t i = 0; i < snapshot.size(); ++i) {
+            if (snapshot.end(i) <= segment.start || snapshot.start(i) >= segment.end) continue;
+            if (snapshot.prot(i) != segment.prot) {
+                printf("%" PRIxPTR" has prot %d, expected %d\n", snapshot.start(i), snapshot.prot(i), segment.prot);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+struct memory {
+    long private_dirty;
+    long pss;
+    long anonymous;
+};
+
+static memory read_memory() {
+    memory m{-1, -1, -1};
+    FILE *file = fopen("/proc/self/smaps_rollup", "r");
+    if (!file) return m;
+
+    char line[256];
+    while (fgets(line, sizeof(line), file)) {
+        sscanf(line, "Private_Dirty: %ld kB", &m.private_dirty);
+        sscanf(line, "Pss: %ld kB", &m.pss);
+        sscanf(line, "Anonymous: %ld kB", &m.anonymous);
+    }
+    fclose(file);
+    return m;
+}
+
+static std::vector<std::pair<void *, size_t>> legacy_backups;
+
+/*
+ * The hide before segments were coalesced: every readable segment on its own, with a backup
+ * which is never freed (released by the benchmark after measuring).
+ */
+static int legacy_hide(const hide_range *ranges, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        auto start = ranges[i].start, length = ranges[i].end - ranges[i].start;
+        int prot = ranges[i].prot;
+        if (!(prot & PROT_READ)) continue;
+
+        auto backup = _mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+        memcpy(backup, (void *) start, length);
+        _munmap((void *) start, length);
+        _mmap((void *) start, length, prot, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+        _mprotect((void *) start, length, prot | PROT_WRITE);
+        memcpy((void *) start, backup, length);
+        if (!(prot & PROT_WRITE)) {
+            _mprotect((void *) start, length, prot);
+        }
+        legacy_backups.emplace_back(backup, length);
+    }
+    return 0;
+}
+
+static void legacy_release() {
+    for (auto &backup : legacy_backups) {
+        munmap(backup.first, backup.second);
+    }
+    legacy_backups.clear();
+}
+
+static int copy_hide(const hide_range *ranges, size_t count) {
+    return hide::hide_images(ranges, count, HIDE_MODE_COPY);
+}
+
+static int mremap_hide(const hide_range *ranges, size_t count) {
+    return hide::hide_images(ranges, count, HIDE_MODE_MREMAP);
+}
+
+static int memfd_hide(const hide_range *ranges, size_t count) {
+    return hide::hide_images(ranges, count, HIDE_MODE_MEMFD);
+}
+
+static int lazy_hide(const hide_range *ranges, size_t count) {
+    hide::lazy_hide(ranges, count);
+    return 0;
+}
+
+using hide_func = int(const hide_range *ranges, size_t count);
+
+static void touch_text(const library &lib) {
+    volatile uint64_t sum = 0;
+    auto &text = lib.segments[0];
+    for (auto p = text.start; p < text.end; p += page_size * 10) {
+        sum += *(const uint64_t *) p;
+    }
+}
+
+static memory difference(const memory &after, const memory &before) {
+    return {after.private_dirty - before.private_dirty, after.pss - before.pss, after.anonymous - before.anonymous};
+}
+
+static void print_row(const char *name, double best, double average, size_t syscalls, const memory &delta, bool ok) {
+    printf("%-8s %9.3f %9.3f %9zu %10ld %10ld %10ld  %s\n", name, best, average, syscalls,
+           delta.private_dirty, delta.pss, delta.anonymous, ok ? "ok" : "FAILED");
+}
+
+static void run_lazy(library &lib, int iterations) {
+    double best = 1e9, total = 0, finish_best = 1e9, finish_total = 0;
+    size_t syscalls = 0, finish_syscalls = 0;
+    memory touched{}, finished{};
+    bool ok = true;
+
+    for (int i = 0; i < iterations; ++i) {
+        if (!map_library(lib)) {
+            perror("map library");
+            exit(1);
+        }
+        auto sum = checksum(lib);
+
+        auto count = syscall_count;
+        auto before = read_memory();
+        double start = now_ms();
+        lazy_hide(lib.segments.data(), lib.segments.size());
+        double time = now_ms() - start;
+        syscalls = syscall_count - count;
+        total += time;
+        if (time < best) best = time;
+
+        touch_text(lib);
+        touched = difference(read_memory(), before);
+
+        count = syscall_count;
+        start = now_ms();
+        hide::lazy_finish();
+        time = now_ms() - start;
+        finish_syscalls = syscall_count - count;
+        finish_total += time;
+        if (time < finish_best) finish_best = time;
+
+        ok = ok && verify(lib) && checksum(lib) == sum;
+        finished = difference(read_memory(), before);
+
+        munmap((void *) lib.start, lib.size);
+    }
+    print_row("lazy", best, total / iterations, syscalls, touched, ok);
+    print_row("finish", finish_best, finish_total / iterations, finish_syscalls, finished, ok);
+}
+
+static void run(const char *name, hide_func *hide, library &lib, int iterations) {
+    double best = 1e9, total = 0;
+    size_t syscalls = 0;
+    memory delta{};
+    bool ok = true;
+
+    for (int i = 0; i < iterations; ++i) {
+        if (!map_library(lib)) {
+            perror("map library");
+            exit(1);
+        }
+        auto sum = checksum(lib);
+
+        auto count = syscall_count;
+        auto before = read_memory();
+        double start = now_ms();
+        hide(lib.segments.data(), lib.segments.size());
+        double time = now_ms() - start;
+        syscalls = syscall_count - count;
+
+        total += time;
+        if (time < best) best = time;
+
+        // legacy leaves ---p segments visible
+        if (hide != legacy_hide) ok = ok && verify(lib);
+        // also faults in what the hide left unmapped in the page tables
+        ok = ok && checksum(lib) == sum;
+
+        auto after = read_memory();
+        delta = difference(after, before);
+        legacy_release();
+
+        munmap((void *) lib.start, lib.size);
+    }
+    print_row(name, best, total / iterations, syscalls, delta, ok);
+}
+
+int main(int argc, char **argv) {
+    size_t size_mb = argc > 1 ? (size_t) atoi(argv[1]) : 8;
+    int iterations = argc > 2 ? atoi(argv[2]) : 10;
+
+    library lib;
+    if (!create_file(lib, size_mb * 1024 * 1024)) {
+        perror("create library");
+        return 1;
+    }
+
+    printf("%zu MB library, 4 segments, %d iterations\n", size_mb, iterations);
+    printf("%-8s %9s %9s %9s %10s %10s %10s\n", "mode", "best ms", "avg ms", "syscalls", "+dirty KB", "+pss KB", "+anon KB");
+    run("legacy", legacy_hide, lib, iterations);
+    run("copy", copy_hide, lib, iterations);
+    run("mremap", mremap_hide, lib, iterations);
+    run("memfd", memfd_hide, lib, iterations);
+    run_lazy(lib, iterations);
+
+    unlink(lib.path.c_str());
+    rmdir(lib.path.substr(0, lib.path.rfind('/')).c_str());
+    return 0;
+}
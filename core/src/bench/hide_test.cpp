@@ -0,0 +1,269 @@
+#include <algorithm>
+#include <cinttypes>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <vector>
+#include <dirent.h>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "hide_lazy.h"
+#include "hide_utils.h"
+#include "hide_wrap.h"
+#include "maps_snapshot.h"
+
+/*
+ * Load synthetic modules (payload.c) with dlopen from a libriru_*.so path, hide them with each
+ * mode and check their code still runs, their data is kept, their segments keep their
+ * protection and the path is gone from maps.
+ *
+ * Reported are the best time of the hide, the syscalls made through wrap.h and the growth of
+ * Rss/Pss/Anonymous (smaps_rollup) from before the hide to after calling the module again.
+ * lazy includes nothing of lazy_finish, which runs after the first call.
+ *
+ * usage: hide_test [-i iterations] [payload.so...]
+ *   payloads default to the libpayload_*.so built next to hide_test, they are copied to a
+ *   directory created in the current directory
+ * Exit status: 0 all checks passed, 1 otherwise.
+ */
+
+static double now_ms() {
+    timespec ts{};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+struct memory {
+    long rss;
+    long pss;
+    long anonymous;
+};
+
+static memory read_memory() {
+    memory m{-1, -1, -1};
+    FILE *file = fopen("/proc/self/smaps_rollup", "r");
+    if (!file) return m;
+
+    char line[256];
+    while (fgets(line, sizeof(line), file)) {
+        sscanf(line, "Rss: %ld kB", &m.rss);
+        sscanf(line, "Pss: %ld kB", &m.pss);
+        sscanf(line, "Anonymous: %ld kB", &m.anonymous);
+    }
+    fclose(file);
+    return m;
+}
+
+static bool copy_file(const char *from, const char *to) {
+    int in = open(from, O_RDONLY | O_CLOEXEC);
+    if (in == -1) return false;
+    int out = open(to, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0755);
+    if (out == -1) {
+        close(in);
+        return false;
+    }
+
+    char buf[65536];
+    ssize_t size;
+    bool ok = true;
+    while ((size = read(in, buf, sizeof(buf))) > 0) {
+        if (write(out, buf, (size_t) size) != size) {
+            ok = false;
+            break;
+        }
+    }
+    fsync(out);
+    close(in);
+    close(out);
+    return ok && size == 0;
+}
+
+static std::vector<std::string> default_payloads(const char *argv0) {
+    std::vector<std::string> payloads;
+    char exe[PATH_MAX];
+    if (!realpath(argv0, exe)) return payloads;
+    auto dir = std::string(exe, strrchr(exe, '/'));
+
+    DIR *d = opendir(dir.c_str());
+    if (!d) return payloads;
+    struct dirent *entry;
+    while ((entry = readdir(d))) {
+        if (strncmp(entry->d_name, "libpayload_", 11) == 0) payloads.push_back(dir + "/" + entry->d_name);
+    }
+    closedir(d);
+
+    // libpayload_8 before libpayload_32
+    std::sort(payloads.begin(), payloads.end(), [](const std::string &a, const std::string &b) {
+        return a.length() != b.length() ? a.length() < b.length() : a < b;
+    });
+    return payloads;
+}
+
+enum test_mode {
+    TEST_COPY,
+    TEST_MREMAP,
+    TEST_MEMFD,
+    TEST_LAZY,
+    TEST_RUNNING
+};
+
+static const char *mode_names[] = {"copy", "mremap", "memfd", "lazy", "running"};
+
+static void run_hide(test_mode mode, const std::vector<hide_range> &ranges) {
+    switch (mode) {
+        case TEST_COPY:
+            hide::hide_images(ranges.data(), ranges.size(), HIDE_MODE_COPY);
+            break;
+        case TEST_MREMAP:
+            hide::hide_images(ranges.data(), ranges.size(), HIDE_MODE_MREMAP);
+            break;
+        case TEST_MEMFD:
+            hide::hide_images(ranges.data(), ranges.size(), HIDE_MODE_MEMFD);
+            break;
+        case TEST_LAZY:
+            hide::lazy_hide(ranges.data(), ranges.size());
+            break;
+        case TEST_RUNNING:
+            hide::hide_images(ranges.data(), ranges.size(), HIDE_MODE_MREMAP, true);
+            break;
+    }
+}
+
+struct result {
+    double best;
+    size_t syscalls;
+    memory delta;
+    const char *error;
+};
+
+/*
+ * Load, hide, call and check once.
+ */
+static void run_once(const char *path, test_mode mode, result &r) {
+    auto handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if (!handle) {
+        printf("dlopen: %s\n", dlerror());
+        r.error = "dlopen";
+        return;
+    }
+    auto sum = (unsigned long (*)()) dlsym(handle, "payload_sum");
+    auto calls = (int *) dlsym(handle, "payload_calls");
+    if (!sum || !calls) {
+        r.error = "dlsym";
+        dlclose(handle);
+        return;
+    }
+
+    // faults in all pages of the file
+    auto expected = sum();
+
+    maps::snapshot snapshot;
+    snapshot.take();
+    std::vector<hide_range> ranges;
+    auto id = snapshot.find_path(path);
+    if (id != maps::snapshot::NO_PATH) {
+        snapshot.for_each_of_path(id, [&](size_t i) {
+            ranges.push_back({snapshot.start(i), snapshot.end(i), snapshot.prot(i)});
+        });
+    }
+    if (ranges.empty()) {
+        r.error = "not in maps";
+        dlclose(handle);
+        return;
+    }
+
+    auto before = read_memory();
+    auto count = syscall_count;
+    double start = now_ms();
+    run_hide(mode, ranges);
+    double time = now_ms() - start;
+    r.syscalls = syscall_count - count;
+    if (time < r.best) r.best = time;
+
+    // runs the code of the module, through the fault handler for lazy
+    if (sum() != expected) r.error = "wrong sum";
+    auto after = read_memory();
+    r.delta = {after.rss - before.rss, after.pss - before.pss, after.anonymous - before.anonymous};
+
+    if (mode == TEST_LAZY) hide::lazy_finish();
+
+    if (sum() != expected) r.error = "wrong sum";
+    if (*calls != 3) r.error = "data lost";
+
+    snapshot.take();
+    if (snapshot.find_path(path) != maps::snapshot::NO_PATH) r.error = "path in maps";
+    for (auto &range : ranges) {
+        for (size_t i = 0; i < snapshot.size(); ++i) {
+            if (snapshot.end(i) <= range.start || snapshot.start(i) >= range.end) continue;
+            if (snapshot.prot(i) != range.prot) r.error = "protection changed";
+        }
+    }
+
+    dlclose(handle);
+}
+
+int main(int argc, char **argv) {
+    int iterations = 3;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "i:")) != -1) {
+        switch (opt) {
+            case 'i':
+                iterations = atoi(optarg);
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-i iterations] [payload.so...]\n", argv[0]);
+                return 1;
+        }
+    }
+    if (iterations < 1) iterations = 1;
+
+    std::vector<std::string> payloads;
+    for (int i = optind; i < argc; ++i) payloads.emplace_back(argv[i]);
+    if (payloads.empty()) payloads = default_payloads(argv[0]);
+    if (payloads.empty()) {
+        fprintf(stderr, "no payload\n");
+        return 1;
+    }
+
+    // in the current directory, pages of tmpfs files count as dirty
+    char dir[] = "riru_hide_test_XXXXXX";
+    char absolute[PATH_MAX];
+    if (!mkdtemp(dir) || !realpath(dir, absolute)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    auto path = std::string(absolute) + "/libriru_payload.so";
+
+    bool failed = false;
+    for (auto &payload : payloads) {
+        struct stat st{};
+        if (!copy_file(payload.c_str(), path.c_str()) || stat(path.c_str(), &st) == -1) {
+            perror(payload.c_str());
+            failed = true;
+            continue;
+        }
+
+        printf("\n%s (%ld KB), best of %d\n", payload.c_str(), (long) st.st_size / 1024, iterations);
+        printf("%-8s %9s %9s %9s %9s %9s  %s\n", "mode", "hide ms", "syscalls", "+rss KB", "+pss KB", "+anon KB", "check");
+        for (int mode = TEST_COPY; mode <= TEST_RUNNING; ++mode) {
+            result r{1e9, 0, {}, nullptr};
+            for (int i = 0; i < iterations && !r.error; ++i) {
+                run_once(path.c_str(), (test_mode) mode, r);
+            }
+            printf("%-8s %9.3f %9zu %9ld %9ld %9ld  %s\n", mode_names[mode], r.best, r.syscalls,
+                   r.delta.rss, r.delta.pss, r.delta.anonymous, r.error ? r.error : "ok");
+            if (r.error) failed = true;
+        }
+    }
+
+    unlink(path.c_str());
+    rmdir(absolute);
+    return failed ? 1 : 0;
+}
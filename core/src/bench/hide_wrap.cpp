@@ -0,0 +1,47 @@
+#include <cstring>
+#include <sys/mman.h>
+#include "hide_wrap.h"
+#include "logging.h"
+#include "wrap.h"
+
+/*
+ * wrap.h for the hide benchmark, the same as wrap.cpp but every call is counted.
+ */
+
+size_t syscall_count = 0;
+
+int _mprotect(void *addr, size_t size, int prot) {
+    syscall_count += 1;
+    int res = mprotect(addr, size, prot);
+    if (res != 0) {
+        PLOGE("mprotect");
+    }
+    return res;
+}
+
+void *_mmap(void *addr, size_t size, int prot, int flags, int fd, off_t offset) {
+    syscall_count += 1;
+    auto res = mmap(addr, size, prot, flags, fd, offset);
+    if (res == MAP_FAILED) {
+        PLOGE("mmap");
+    }
+    return res;
+}
+
+int _munmap(void *addr, size_t size) {
+    syscall_count += 1;
+    int res = munmap(addr, size);
+    if (res != 0) {
+        PLOGE("munmap");
+    }
+    return res;
+}
+
+void *_mremap(void *old_addr, size_t old_size, size_t new_size, int flags, void *new_addr) {
+    syscall_count += 1;
+    auto res = mremap(old_addr, old_size, new_size, flags, new_addr);
+    if (res == MAP_FAILED) {
+        PLOGE("mremap");
+    }
+    return res;
+}
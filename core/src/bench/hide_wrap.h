@@ -0,0 +1,6 @@
+#pragma once
+
+#include <cstddef>
+
+// calls made through wrap.h since the start of the process
+extern size_t syscall_count;
@@ -0,0 +1,18 @@
+#pragma once
+
+/*
+ * Host replacement of liblog, so that core sources can be built into benchmarks on Linux.
+ */
+
+#include <stdio.h>
+
+enum {
+    ANDROID_LOG_VERBOSE = 2,
+    ANDROID_LOG_DEBUG,
+    ANDROID_LOG_INFO,
+    ANDROID_LOG_WARN,
+    ANDROID_LOG_ERROR
+};
+
+#define __android_log_print(prio, tag, ...) \
+    ((prio) >= ANDROID_LOG_WARN ? (fprintf(stderr, "%s: ", tag), fprintf(stderr, __VA_ARGS__), fputc('\n', stderr)) : 0)
@@ -0,0 +1,383 @@
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include "maps.h"
+#include "maps_index.h"
+#include "maps_snapshot.h"
+#include "pmparser.h"
+
+/*
+ * Compare the maps parsers of core on synthetic and recorded maps files.
+ *
+ * Every (file, parser) pair runs in its own child process, so allocations and peak RSS are
+ * those of the parser alone (RSS is reported above an idle child).
+ *
+ * usage: maps_bench [-p procfs_root] [-i iterations] [-w dir] [maps_file...]
+ *   -p  root of procfs, <root>/self/maps is used as the recorded file (default /proc)
+ *   -i  iterations of each case (default 20)
+ *   -w  also write the synthetic fixtures to dir
+ *   maps_file  recorded maps files to add, e.g. pulled from a device with
+ *              adb shell su -c cat /proc/$(pidof zygote64)/maps
+ */
+
+// ---------------------------------------------------------
+// allocation counting, glibc only
+
+static size_t alloc_count = 0;
+static size_t alloc_bytes = 0;
+
+#ifdef __GLIBC__
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t n, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+
+void *malloc(size_t size) {
+    alloc_count += 1;
+    alloc_bytes += size;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size) {
+    alloc_count += 1;
+    alloc_bytes += n * size;
+    return __libc_calloc(n, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    alloc_count += 1;
+    alloc_bytes += size;
+    return __libc_realloc(ptr, size);
+}
+}
+#endif
+
+// ---------------------------------------------------------
+// fixtures
+
+static const char *long_dir =
+        "/data/app/~~a1b2c3d4e5f6g7h8i9j0kA==/com.example.with.a.very.long.package.name.for.testing-"
+        "Zm9vYmFyYmF6cXV4cXV1eGNvcmdlZ3JhdWx0Z2FycGx5d2FsZG9mcmVkcGx1Z2h4eXp6eQ==/lib/arm64/"
+        "nested/directory/structure/that/keeps/going/for/quite/a/while/to/stress/path/handling";
+
+static void write_synthetic_maps(FILE *file, int lines) {
+    uintptr_t address = 0x12c00000;
+    for (int i = 0; i < lines; ++i) {
+        uintptr_t size = (uintptr_t) ((i % 7) + 1) * 0x1000;
+        const char *perm = i % 3 == 0 ? "r-xp" : (i % 3 == 1 ? "r--p" : "rw-p");
+
+        fprintf(file, "%" PRIxPTR"-%" PRIxPTR" %s %08x fd:0%d %d", address, address + size, perm,
+                (i % 5) * 0x1000, i % 4, i % 8 == 0 ? 0 : 100000 + i);
+        switch (i % 8) {
+            case 0:
+                fprintf(file, "\n");
+                break;
+            case 1:
+            case 2:
+                fprintf(file, "                             /system/lib64/libsynthetic_%d.so\n", i / 8);
+                break;
+            case 3:
+                fprintf(file, "                             [anon:dalvik-LinearAlloc %d]\n", i);
+                break;
+            case 4:
+                fprintf(file, "                             /data/app/com.example.app%d-1/oat/arm64/base.odex\n", i / 8);
+                break;
+            case 5:
+                fprintf(file, "                             /dev/ashmem/dalvik-jit-code-cache (deleted)\n");
+                break;
+            case 6:
+                fprintf(file, "                             %s/libpayload_%d.so\n", long_dir, i / 8);
+                break;
+            default:
+                fprintf(file, "                             /data/local/tmp/replaced_%d.so (deleted)\n", i / 8);
+                break;
+        }
+        address += size;
+    }
+}
+
+static std::string make_synthetic(const char *dir, int lines) {
+    char path[PATH_MAX];
+    int fd;
+    if (dir) {
+        snprintf(path, sizeof(path), "%s/synthetic_%d.maps", dir, lines);
+        fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    } else {
+        snprintf(path, sizeof(path), "/tmp/riru_maps_XXXXXX");
+        fd = mkstemp(path);
+        if (fd == -1) {
+            perror("mkstemp");
+            exit(1);
+        }
+    }
+    if (fd == -1) {
+        perror(path);
+        exit(1);
+    }
+    FILE *file = fdopen(fd, "w");
+    write_synthetic_maps(file, lines);
+    fclose(file);
+    return path;
+}
+
+// copy a live maps file, reading procfs while parsing would measure the kernel instead
+static std::string record(const char *procfs) {
+    char from[PATH_MAX], path[] = "/tmp/riru_maps_XXXXXX";
+    snprintf(from, sizeof(from), "%s/self/maps", procfs);
+
+    int in = open(from, O_RDONLY | O_CLOEXEC);
+    if (in == -1) {
+        perror(from);
+        return "";
+    }
+    int out = mkstemp(path);
+    if (out == -1) {
+        perror("mkstemp");
+        exit(1);
+    }
+    char buf[4096];
+    ssize_t size;
+    while ((size = read(in, buf, sizeof(buf))) > 0) {
+        if (write(out, buf, (size_t) size) != size) break;
+    }
+    close(in);
+    close(out);
+    return path;
+}
+
+// ---------------------------------------------------------
+// parsers
+
+static int bench_pmparser(const char *path) {
+    procmaps_iterator *maps = pmparser_parse_file(path);
+    if (maps == nullptr) return -1;
+
+    int count = 0;
+    procmaps_struct *maps_tmp;
+    while ((maps_tmp = pmparser_next(maps)) != nullptr) {
+        if (maps_tmp->is_x) count++;
+    }
+    pmparser_free(maps);
+    free(maps);
+    return count;
+}
+
+static int bench_maps(const char *path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return -1;
+
+    int count = 0;
+    maps::for_each_fd(fd, [&count](const maps::mapping &mapping) -> bool {
+        if (mapping.perms & maps::PERM_X) count++;
+        return true;
+    });
+    close(fd);
+    return count;
+}
+
+static int bench_query(const char *path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return -1;
+
+    const char *patterns[] = {
+            "/system/lib64/libsynthetic_10.so",
+            "/system/lib64/libsynthetic_500.so",
+            "/system/lib64/libsynthetic_900.so",
+            "/system/lib64/libsynthetic_1900.so"
+    };
+    maps::filter filter{maps::FILTER_EXACT, patterns, sizeof(patterns) / sizeof(patterns[0])};
+
+    int count = 0;
+    maps::query_fd(fd, filter, [&count](const maps::mapping &mapping) -> bool {
+        if (mapping.perms & maps::PERM_X) count++;
+        return true;
+    });
+    close(fd);
+    return count;
+}
+
+static int bench_index(const char *path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return -1;
+
+    maps::snapshot snapshot;
+    int res = snapshot.take_fd(fd);
+    close(fd);
+    if (res == -1) return -1;
+
+    maps::interval_index index(snapshot);
+    int count = 0;
+    for (size_t i = 0; i < snapshot.size(); ++i) {
+        auto entry = index.find(snapshot.start(i));
+        if (entry && (entry->perms & maps::PERM_X)) count++;
+    }
+    return count;
+}
+
+// only read the file and look for a byte which is not there
+static int bench_read(const char *path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return -1;
+
+    char buf[maps::BUFFER_SIZE];
+    int count = 0;
+    ssize_t size;
+    while ((size = read(fd, buf, sizeof(buf))) > 0) {
+        if (memchr(buf, '\x01', (size_t) size)) count++;
+    }
+    close(fd);
+    return count;
+}
+
+static int bench_idle(const char *) {
+    return 0;
+}
+
+// ---------------------------------------------------------
+
+struct result {
+    double best;
+    double average;
+    size_t allocs;
+    size_t alloc_bytes;
+    int count;
+};
+
+static double now_ms() {
+    timespec ts{};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+/*
+ * Run func in a child, returns its peak RSS in KB (-1 on failure).
+ */
+static long run_child(int (*func)(const char *), const char *path, int iterations, result *out) {
+    int fds[2];
+    if (pipe(fds) == -1) return -1;
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(fds[0]);
+        result r{1e9, 0, 0, 0, 0};
+        double total = 0;
+        for (int i = 0; i < iterations; ++i) {
+            size_t count = alloc_count, bytes = alloc_bytes;
+            double start = now_ms();
+            r.count = func(path);
+            double time = now_ms() - start;
+            // allocations of one run
+            r.allocs = alloc_count - count;
+            r.alloc_bytes = alloc_bytes - bytes;
+            total += time;
+            if (time < r.best) r.best = time;
+        }
+        r.average = total / iterations;
+        if (write(fds[1], &r, sizeof(r)) != sizeof(r)) _exit(1);
+        _exit(0);
+    }
+    close(fds[1]);
+
+    bool ok = read(fds[0], out, sizeof(*out)) == sizeof(*out);
+    close(fds[0]);
+
+    int status;
+    rusage usage{};
+    if (wait4(pid, &status, 0, &usage) == -1 || !ok) return -1;
+    return usage.ru_maxrss;
+}
+
+struct parser {
+    const char *name;
+    int (*func)(const char *);
+};
+
+static const parser parsers[] = {
+        {"pmparser", bench_pmparser},
+        {"maps",     bench_maps},
+        {"query",    bench_query},
+        {"index",    bench_index},
+        {"read",     bench_read},
+};
+
+static int count_lines(const char *path) {
+    FILE *file = fopen(path, "r");
+    if (!file) return -1;
+    int lines = 0, c;
+    while ((c = fgetc(file)) != EOF) {
+        if (c == '\n') lines++;
+    }
+    fclose(file);
+    return lines;
+}
+
+static void bench_file(const char *label, const char *path, int iterations) {
+    result r{};
+    long idle_rss = run_child(bench_idle, path, 1, &r);
+
+    printf("\n%s (%d lines)\n", label, count_lines(path));
+    printf("%-10s %10s %10s %10s %12s %10s %8s\n", "parser", "best ms", "avg ms", "allocs", "alloc bytes", "rss KB", "result");
+    for (auto &p : parsers) {
+        long rss = run_child(p.func, path, iterations, &r);
+        if (rss == -1) {
+            printf("%-10s failed\n", p.name);
+            continue;
+        }
+        printf("%-10s %10.3f %10.3f %10zu %12zu %10ld %8d\n", p.name, r.best, r.average, r.allocs,
+               r.alloc_bytes, rss - idle_rss, r.count);
+    }
+}
+
+int main(int argc, char **argv) {
+    const char *procfs = "/proc";
+    const char *fixtures_dir = nullptr;
+    int iterations = 20;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "p:i:w:")) != -1) {
+        switch (opt) {
+            case 'p':
+                procfs = optarg;
+                break;
+            case 'i':
+                iterations = atoi(optarg);
+                break;
+            case 'w':
+                fixtures_dir = optarg;
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-p procfs_root] [-i iterations] [-w dir] [maps_file...]\n", argv[0]);
+                return 2;
+        }
+    }
+    if (iterations < 1) iterations = 1;
+
+    printf("%d iterations, procfs %s\n", iterations, procfs);
+
+    for (int lines : {100, 3000, 20000}) {
+        auto path = make_synthetic(fixtures_dir, lines);
+        char label[32];
+        snprintf(label, sizeof(label), "synthetic %d", lines);
+        bench_file(label, path.c_str(), iterations);
+        if (!fixtures_dir) unlink(path.c_str());
+    }
+
+    auto recorded = record(procfs);
+    if (!recorded.empty()) {
+        bench_file("recorded self", recorded.c_str(), iterations);
+        unlink(recorded.c_str());
+    }
+
+    for (int i = optind; i < argc; ++i) {
+        bench_file(argv[i], argv[i], iterations);
+    }
+    return 0;
+}
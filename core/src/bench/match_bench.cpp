@@ -0,0 +1,146 @@
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <vector>
+#include <climits>
+#include <fcntl.h>
+#include <unistd.h>
+#include "hide_utils.h"
+#include "maps.h"
+#include "maps_snapshot.h"
+
+/*
+ * Cost of finding the mappings to hide against the number of modules, on a synthetic maps
+ * file of 5000 lines with 50 modules loaded (4 segments each).
+ *
+ *   format  format LIB_PATH "libriru_%s.so" for every module and compare, for each line
+ *   take    read the snapshot (the same for any number of modules)
+ *   collect hide::collect on the snapshot
+ *
+ * usage: match_bench [iterations]
+ */
+
+#ifdef __LP64__
+#define LIB_PATH "/system/lib64/"
+#else
+#define LIB_PATH "/system/lib/"
+#endif
+
+static const int LINES = 5000;
+static const int LOADED_MODULES = 50;
+
+static double now_ms() {
+    timespec ts{};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static std::string make_maps() {
+    char path[] = "/tmp/riru_match_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd == -1) {
+        perror("mkstemp");
+        exit(1);
+    }
+    FILE *file = fdopen(fd, "w");
+
+    static const char *perms[] = {"r--p", "r-xp", "---p", "rw-p"};
+    uintptr_t address = 0x70000000;
+    int module = 0;
+    for (int i = 0; i < LINES; ++i) {
+        // a module every LINES / LOADED_MODULES lines
+        if (module < LOADED_MODULES && i % (LINES / LOADED_MODULES) == 0 && i + 4 <= LINES) {
+            for (int s = 0; s < 4; ++s, ++i) {
+                fprintf(file, "%" PRIxPTR"-%" PRIxPTR" %s %08x fd:04 %d                   " LIB_PATH "libriru_module%d.so\n",
+                        address, address + 0x4000, perms[s], s * 0x4000, 2000 + module, module);
+                address += 0x4000;
+            }
+            ++module;
+            --i;
+            continue;
+        }
+        if (i % 3 == 0) {
+            fprintf(file, "%" PRIxPTR"-%" PRIxPTR" rw-p 00000000 00:00 0                   [anon:libc_malloc]\n", address, address + 0x1000);
+        } else {
+            fprintf(file, "%" PRIxPTR"-%" PRIxPTR" r-xp 00000000 fd:04 %d                   /system/lib64/libsystem_%d.so\n",
+                    address, address + 0x1000, 100000 + i, i);
+        }
+        address += 0x1000;
+    }
+    fclose(file);
+    return path;
+}
+
+/*
+ * What the hide did before snapshots: format every module path for every line.
+ */
+static size_t match_format(const char *path, const char **names, int count) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    size_t found = 0;
+    char buf[PATH_MAX];
+    maps::for_each_fd(fd, [&](const maps::mapping &mapping) -> bool {
+        if (mapping.path.empty()) return true;
+        for (int i = 0; i < count; ++i) {
+            snprintf(buf, PATH_MAX, LIB_PATH "libriru_%s.so", names[i]);
+            if (strncmp(buf, mapping.path.data, mapping.path.length) == 0 && buf[mapping.path.length] == '\0') {
+                found++;
+                break;
+            }
+        }
+        return true;
+    });
+    close(fd);
+    return found;
+}
+
+int main(int argc, char **argv) {
+    int iterations = argc > 1 ? atoi(argv[1]) : 20;
+    if (iterations < 1) iterations = 1;
+
+    auto path = make_maps();
+
+    std::vector<std::string> storage;
+    std::vector<const char *> names;
+    for (int i = 0; i < 400; ++i) {
+        storage.push_back("module" + std::to_string(i));
+    }
+    for (auto &name : storage) {
+        names.push_back(name.c_str());
+    }
+
+    printf("%d lines, %d modules loaded, best of %d\n", LINES, LOADED_MODULES, iterations);
+    printf("%8s %10s %10s %10s %8s\n", "modules", "format ms", "take ms", "collect ms", "ranges");
+    for (int count : {1, 10, 50, 100, 400}) {
+        double format_best = 1e9, take_best = 1e9, collect_best = 1e9;
+        size_t found = 0, ranges = 0;
+        for (int i = 0; i < iterations; ++i) {
+            double start = now_ms();
+            found = match_format(path.c_str(), names.data(), count);
+            double time = now_ms() - start;
+            if (time < format_best) format_best = time;
+
+            int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            maps::snapshot snapshot;
+            start = now_ms();
+            snapshot.take_fd(fd);
+            time = now_ms() - start;
+            close(fd);
+            if (time < take_best) take_best = time;
+
+            std::vector<hide_range> riru, modules;
+            start = now_ms();
+            hide::collect(snapshot, names.data(), count, riru, modules);
+            time = now_ms() - start;
+            if (time < collect_best) collect_best = time;
+            ranges = modules.size();
+        }
+        if (found != ranges) printf("format found %zu, collect %zu\n", found, ranges);
+        printf("%8d %10.3f %10.3f %10.3f %8zu\n", count, format_best, take_best, collect_best, ranges);
+    }
+
+    unlink(path.c_str());
+    return 0;
+}
@@ -0,0 +1,30 @@
+/*
+ * Synthetic module for hide_test: PAYLOAD_SIZE_MB megabytes, half in the executable segment,
+ * half in read-only data, and some writable data.
+ */
+
+#ifndef PAYLOAD_SIZE_MB
+#define PAYLOAD_SIZE_MB 8
+#endif
+
+#define TABLE_LENGTH (PAYLOAD_SIZE_MB * 1024 * 1024 / 2 / sizeof(unsigned int))
+
+// initialized, so it is in the file, not zero fill
+__attribute__((section(".text.payload"), used))
+static const unsigned int code_table[TABLE_LENGTH] = {1, 2, 3};
+
+static const unsigned int data_table[TABLE_LENGTH] = {4, 5, 6};
+
+int payload_calls = 0;
+
+/*
+ * Reads a word of every page of both tables.
+ */
+unsigned long payload_sum(void) {
+    unsigned long sum = 0;
+    for (unsigned long i = 0; i < TABLE_LENGTH; i += 1024) {
+        sum = sum * 31 + code_table[i] + data_table[i] + i;
+    }
+    payload_calls++;
+    return sum;
+}
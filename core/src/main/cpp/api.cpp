@@ -1,11 +1,15 @@
 #include <cstring>
 #include <map>
+#include <mutex>
 #include <vector>
 #include <jni.h>
 
 #include "logging.h"
 #include "module.h"
 #include "api.h"
+#include "blob.h"
+#include "jni_predicate.h"
+#include "maps_index.h"
 
 namespace api {
 
@@ -17,10 +21,23 @@ namespace api {
                 methods(methods), count(count) {}
     };
 
-    static auto *native_methods = new std::map<std::string, JNINativeMethodHolder *>();
+    using native_method_map = std::map<const char *, JNINativeMethodHolder *, arena::less_str,
+            arena::allocator<std::pair<const char *const, JNINativeMethodHolder *>>>;
+
+    static auto *native_methods = arena::make<native_method_map>();
+    // filled by the hook while the modules may be loading in background
+    static std::mutex native_methods_mutex;
 
     void putNativeMethod(const char *className, const JNINativeMethod *methods, int numMethods) {
-        (*native_methods)[className] = new JNINativeMethodHolder(methods, numMethods);
+        std::lock_guard<std::mutex> lock(native_methods_mutex);
+        arena::scope writable;
+        auto holder = arena::make<JNINativeMethodHolder>(methods, numMethods);
+        auto it = native_methods->find(className);
+        if (it != native_methods->end()) {
+            it->second = holder;
+        } else {
+            native_methods->emplace(arena::strdup(className), holder);
+        }
     }
 
     static unsigned long get_module_index(uint32_t token) {
@@ -34,6 +51,7 @@ namespace api {
     const JNINativeMethod *getOriginalNativeMethod(
             const char *className, const char *name, const char *signature) {
 
+        std::lock_guard<std::mutex> lock(native_methods_mutex);
         auto it = native_methods->find(className);
         if (it != native_methods->end()) {
             if (!name && !signature)
@@ -50,6 +68,9 @@ namespace api {
         return nullptr;
     }
 
+    // modules with a parallel onModuleLoaded may set functions while others look them up
+    static std::mutex funcs_mutex;
+
     void *getFunc(uint32_t token, const char *name) {
         unsigned long index = get_module_index(token);
         if (index == 0)
@@ -61,10 +82,12 @@ namespace api {
 
         // find if it is set by previous modules
         if (index != 0) {
+            std::lock_guard<std::mutex> lock(funcs_mutex);
             for (unsigned long i = index - 1; i >= 0; --i) {
                 auto module = get_modules()->at(i);
+                // a trimmed module may be unloaded
                 auto it = module->funcs->find(name);
-                if (module->funcs->end() != it)
+                if (!module->trimmed && module->funcs->end() != it)
                     return it->second;
 
                 if (i == 0) break;
@@ -85,11 +108,13 @@ namespace api {
         // find if it is set by previous modules
         char buf[4096];
         if (index != 0) {
+            std::lock_guard<std::mutex> lock(funcs_mutex);
             for (unsigned long i = index - 1; i >= 0; --i) {
                 snprintf(buf, 4090, "%s%s%s", className, name, signature);
                 auto module = get_modules()->at(i);
-                auto it = module->funcs->find(std::string(className) + name + signature);
-                if (module->funcs->end() != it)
+                // a trimmed module may be unloaded
+                auto it = module->funcs->find(buf);
+                if (!module->trimmed && module->funcs->end() != it)
                     return it->second;
 
                 if (i == 0) break;
@@ -109,7 +134,14 @@ namespace api {
         //LOGV("set_func %s %s %p", module_name, name, func);
 
         auto module = get_modules()->at(index - 1);
-        (*module->funcs)[name] = func;
+        std::lock_guard<std::mutex> lock(funcs_mutex);
+        arena::scope writable;
+        auto it = module->funcs->find(name);
+        if (it != module->funcs->end()) {
+            it->second = func;
+        } else {
+            module->funcs->emplace(arena::strdup(name), func);
+        }
     }
 
     void setNativeMethodFunc(
@@ -119,17 +151,99 @@ namespace api {
         setFunc(token, buf, func);
     }
 
-    static auto *global_values = new std::map<std::string, void *>();
+    int addStringPredicate(
+            uint32_t token, const char *className, const char *name, const char *signature,
+            int argIndex, const char *prefix, const char *suffix, RiruStringPredicateCallback_v10 *callback) {
+        if (get_module_index(token) == 0)
+            return -1;
+
+        auto interposer = predicate::find(className, name, signature);
+        if (!interposer) {
+            LOGW("%s#%s%s is not interposed", className, name, signature);
+            return -1;
+        }
+        return predicate::add(interposer, token, argIndex, prefix, suffix, callback);
+    }
+
+    static maps::interval_index *maps_index = nullptr;
+    static std::mutex maps_index_mutex;
+
+    int findMappings(
+            uint32_t token, const uintptr_t *addresses, RiruMapping_v10 *mappings, int count, int refresh) {
+        if (get_module_index(token) == 0 || count < 0)
+            return -1;
+
+        if (count > 0 && (!addresses || !mappings))
+            return -1;
+
+        std::lock_guard<std::mutex> lock(maps_index_mutex);
+
+        if (!maps_index || refresh) {
+            maps::snapshot snapshot;
+            if (snapshot.take() == -1) {
+                PLOGE("read memory map");
+                return -1;
+            }
+            delete maps_index;
+            maps_index = new maps::interval_index(snapshot);
+        }
+
+        std::vector<const maps::interval_index::entry *> results((size_t) count);
+        auto found = maps_index->find(addresses, results.data(), (size_t) count);
+
+        for (int i = 0; i < count; ++i) {
+            auto entry = results[i];
+            if (entry) {
+                mappings[i] = {entry->start, entry->end, entry->offset, maps::to_prot(entry->perms), entry->path};
+            } else {
+                mappings[i] = {0, 0, 0, 0, ""};
+            }
+        }
+        return (int) found;
+    }
+
+    int publishBlob(uint32_t token, const char *name, const void *data, size_t size) {
+        if (get_module_index(token) == 0)
+            return -1;
+
+        return blob::publish(name, data, size);
+    }
+
+    int publishBlobFile(uint32_t token, const char *name, const char *path) {
+        if (get_module_index(token) == 0)
+            return -1;
+
+        return blob::publish_file(name, path);
+    }
+
+    const void *getBlob(uint32_t token, const char *name, size_t *size) {
+        if (get_module_index(token) == 0)
+            return nullptr;
+
+        return blob::get(name, size);
+    }
+
+    using global_value_map = std::map<const char *, void *, arena::less_str,
+            arena::allocator<std::pair<const char *const, void *>>>;
+
+    static auto *global_values = arena::make<global_value_map>();
+    static std::mutex global_values_mutex;
 
     void putGlobalValue(const char *key, void *value) {
+        std::lock_guard<std::mutex> lock(global_values_mutex);
+        arena::scope writable;
+        auto it = global_values->find(key);
         if (value == nullptr) {
-            global_values->erase(key);
+            if (it != global_values->end()) global_values->erase(it);
+        } else if (it != global_values->end()) {
+            it->second = value;
         } else {
-            (*global_values)[key] = value;
+            global_values->emplace(arena::strdup(key), value);
         }
     }
 
     void *getGlobalValue(const char *key) {
+        std::lock_guard<std::mutex> lock(global_values_mutex);
         auto it = global_values->find(key);
         if (global_values->end() != it)
             return it->second;
@@ -22,6 +22,19 @@ namespace api {
     const JNINativeMethod *getOriginalNativeMethod(
             const char *className, const char *name, const char *signature) KEEP;
 
+    int addStringPredicate(
+            uint32_t token, const char *className, const char *name, const char *signature,
+            int argIndex, const char *prefix, const char *suffix, RiruStringPredicateCallback_v10 *callback) KEEP;
+
+    int findMappings(
+            uint32_t token, const uintptr_t *addresses, RiruMapping_v10 *mappings, int count, int refresh) KEEP;
+
+    int publishBlob(uint32_t token, const char *name, const void *data, size_t size) KEEP;
+
+    int publishBlobFile(uint32_t token, const char *name, const char *path) KEEP;
+
+    const void *getBlob(uint32_t token, const char *name, size_t *size) KEEP;
+
     void putGlobalValue(const char *key, void *value);
 
     void *getGlobalValue(const char *key);
@@ -0,0 +1,119 @@
+#include <cstdint>
+#include <cstdlib>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include "arena.h"
+#include "logging.h"
+#include "wrap.h"
+
+#ifndef PR_SET_VMA
+#define PR_SET_VMA 0x53564d41
+#define PR_SET_VMA_ANON_NAME 0
+#endif
+
+namespace arena {
+
+    static constexpr size_t CHUNK_SIZE = 64 * 1024;
+    static constexpr size_t MAX_CHUNKS = 64;
+
+    namespace {
+        struct chunk {
+            uintptr_t start;
+            size_t size;
+        };
+    }
+
+    // the bookkeeping is outside of the arena, it changes with every allocation
+    static chunk chunks[MAX_CHUNKS];
+    static size_t chunk_count = 0;
+    static uintptr_t cursor = 0;
+    static uintptr_t limit = 0;
+
+    static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+    static bool frozen = false;
+    // given to freeze(), for the chunks mapped after it too
+    static const char *frozen_label = nullptr;
+    static int scopes = 0;
+
+    static void protect(int prot) {
+        for (size_t i = 0; i < chunk_count; ++i) {
+            if (_mprotect((void *) chunks[i].start, chunks[i].size, prot) == -1) {
+                PLOGE("mprotect arena");
+            }
+        }
+    }
+
+    void *alloc(size_t size, size_t align) {
+        pthread_mutex_lock(&mutex);
+        // the memory could not be written, fail here rather than in the caller
+        if (frozen && scopes == 0) {
+            LOGE("arena allocation of %zu bytes outside of a scope after freeze", size);
+            abort();
+        }
+
+        auto start = (cursor + align - 1) & ~(align - 1);
+        if (cursor == 0 || start + size > limit) {
+            auto page_size = (size_t) sysconf(_SC_PAGESIZE);
+            auto chunk_size = size + align > CHUNK_SIZE ? (size + align + page_size - 1) & ~(page_size - 1) : CHUNK_SIZE;
+
+            void *p = MAP_FAILED;
+            if (chunk_count < MAX_CHUNKS) {
+                p = _mmap(nullptr, chunk_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            }
+            if (p == MAP_FAILED) {
+                pthread_mutex_unlock(&mutex);
+                LOGE("arena is full, use the heap");
+                return malloc(size);
+            }
+            chunks[chunk_count++] = {(uintptr_t) p, chunk_size};
+            if (frozen_label) {
+                prctl(PR_SET_VMA, PR_SET_VMA_ANON_NAME, (uintptr_t) p, chunk_size, frozen_label);
+            }
+            cursor = (uintptr_t) p;
+            limit = cursor + chunk_size;
+            start = (cursor + align - 1) & ~(align - 1);
+        }
+        cursor = start + size;
+        pthread_mutex_unlock(&mutex);
+        return (void *) start;
+    }
+
+    char *strdup(const char *str) {
+        auto size = strlen(str) + 1;
+        auto copy = (char *) alloc(size, 1);
+        memcpy(copy, str, size);
+        return copy;
+    }
+
+    void freeze(const char *label) {
+        pthread_mutex_lock(&mutex);
+        if (!frozen) {
+            frozen = true;
+            frozen_label = label;
+            if (scopes == 0) protect(PROT_READ);
+
+            for (size_t i = 0; label && i < chunk_count; ++i) {
+                prctl(PR_SET_VMA, PR_SET_VMA_ANON_NAME, chunks[i].start, chunks[i].size, label);
+            }
+
+            size_t mapped = 0;
+            for (size_t i = 0; i < chunk_count; ++i) mapped += chunks[i].size;
+            LOGD("arena frozen, %zu chunks, %zu bytes", chunk_count, mapped);
+        }
+        pthread_mutex_unlock(&mutex);
+    }
+
+    scope::scope() {
+        pthread_mutex_lock(&mutex);
+        if (scopes++ == 0 && frozen) protect(PROT_READ | PROT_WRITE);
+        pthread_mutex_unlock(&mutex);
+    }
+
+    scope::~scope() {
+        pthread_mutex_lock(&mutex);
+        if (--scopes == 0 && frozen) protect(PROT_READ);
+        pthread_mutex_unlock(&mutex);
+    }
+}
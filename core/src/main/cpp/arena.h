@@ -0,0 +1,90 @@
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <new>
+#include <utility>
+#include <vector>
+
+/*
+ * Allocations which live as long as zygote (modules, their functions, the original JNI methods)
+ * are bumped from a few dedicated mappings instead of the heap. They are dense, never freed,
+ * and made read-only by freeze() once zygote is initialized: the pages stay shared by all the
+ * processes forked from zygote, no write can break the sharing by accident.
+ *
+ * Anything modifying them after freeze() has to hold an arena::scope.
+ *
+ * What changes after zygote is initialized stays on the heap on purpose: the manifest records
+ * compared before each fork, the string predicates (dropped per process by trimming), the
+ * hook work deferred while loading in background and the index of the memory map.
+ */
+namespace arena {
+
+    /**
+     * Memory from the arena, writable only inside a scope after freeze(). Thread safe.
+     * Allocating outside a scope after freeze() aborts.
+     */
+    void *alloc(size_t size, size_t align = alignof(std::max_align_t));
+
+    char *strdup(const char *str);
+
+    template<typename T, typename... Args>
+    T *make(Args &&... args) {
+        return new(alloc(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+    }
+
+    /**
+     * Make the arena read-only, unless a scope is open (then when the last one closes).
+     * @param label name of the mappings (PR_SET_VMA_ANON_NAME), nullptr for none
+     */
+    void freeze(const char *label);
+
+    /**
+     * The arena is writable while a scope is alive.
+     */
+    class scope {
+    public:
+        scope();
+
+        ~scope();
+
+        scope(const scope &) = delete;
+
+        scope &operator=(const scope &) = delete;
+    };
+
+    /**
+     * For containers in the arena, nothing is ever freed.
+     */
+    template<typename T>
+    struct allocator {
+        using value_type = T;
+
+        allocator() = default;
+
+        template<typename U>
+        allocator(const allocator<U> &) {}
+
+        T *allocate(size_t n) {
+            return (T *) alloc(n * sizeof(T), alignof(T));
+        }
+
+        void deallocate(T *, size_t) {}
+
+        template<typename U>
+        bool operator==(const allocator<U> &) const { return true; }
+
+        template<typename U>
+        bool operator!=(const allocator<U> &) const { return false; }
+    };
+
+    // keys of maps in the arena are strdup'ed there, lookups by a plain string allocate nothing
+    struct less_str {
+        bool operator()(const char *a, const char *b) const {
+            return strcmp(a, b) < 0;
+        }
+    };
+
+    // strings in the arena, strdup'ed there
+    using string_list = std::vector<const char *, allocator<const char *>>;
+}
@@ -0,0 +1,168 @@
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cinttypes>
+#include "maps.h"
+
+/*
+ * Check that no process exposes Riru libraries in its maps.
+ *
+ * usage: riruaudit [-p procfs_root] [-j threads] [pattern...]
+ *
+ * Every /proc/<pid>/maps is scanned with the filtered scanner on a pool of threads. Each leaking
+ * mapping is printed as one tab separated line:
+ *
+ *   <pid> <comm> <start>-<end> <perms> <offset> <path>
+ *
+ * Processes which cannot be read are reported to stderr. Patterns are matched anywhere in the
+ * path, "/libriru" by default, and only paths ending with ".so" count.
+ *
+ * Exit status: 0 nothing found, 1 leaks found, 2 error or some process could not be read.
+ */
+
+struct process {
+    int pid;
+    std::string output;
+    int error;
+};
+
+static const char *procfs = "/proc";
+
+static void read_comm(int pid, char *buf, size_t size) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%d/comm", procfs, pid);
+
+    buf[0] = '\0';
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return;
+
+    auto count = read(fd, buf, size - 1);
+    close(fd);
+    if (count <= 0) count = 0;
+    buf[count] = '\0';
+
+    auto eol = strchr(buf, '\n');
+    if (eol) *eol = '\0';
+}
+
+static void audit(process &p, const maps::filter &filter) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%d/maps", procfs, p.pid);
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        // gone since the directory was listed
+        if (errno != ENOENT && errno != ESRCH) p.error = errno;
+        return;
+    }
+
+    char comm[32] = {};
+    char line[PATH_MAX + 128];
+
+    auto res = maps::query_fd(fd, filter, [&](const maps::mapping &mapping) -> bool {
+        if (!mapping.path.ends_with(".so")) return true;
+
+        if (comm[0] == '\0') read_comm(p.pid, comm, sizeof(comm));
+
+        char perms[5];
+        mapping.perm_string(perms);
+        snprintf(line, sizeof(line), "%d\t%s\t%" PRIxPTR"-%" PRIxPTR"\t%s\t%" PRIx64"\t%.*s\n",
+                 p.pid, comm, mapping.start, mapping.end, perms, mapping.offset,
+                 (int) mapping.path.length, mapping.path.data);
+        p.output += line;
+        return true;
+    });
+    if (res == -1) p.error = errno;
+    close(fd);
+}
+
+static bool list_processes(std::vector<process> &processes) {
+    DIR *dir = opendir(procfs);
+    if (!dir) {
+        fprintf(stderr, "opendir %s: %s\n", procfs, strerror(errno));
+        return false;
+    }
+
+    int self = getpid();
+    struct dirent *entry;
+    while ((entry = readdir(dir))) {
+        char *end;
+        long pid = strtol(entry->d_name, &end, 10);
+        if (*end != '\0' || pid <= 0 || pid == self) continue;
+
+        processes.push_back({(int) pid, std::string(), 0});
+    }
+    closedir(dir);
+    return true;
+}
+
+int main(int argc, char **argv) {
+    int threads = (int) std::thread::hardware_concurrency();
+
+    int opt;
+    while ((opt = getopt(argc, argv, "p:j:")) != -1) {
+        switch (opt) {
+            case 'p':
+                procfs = optarg;
+                break;
+            case 'j':
+                threads = atoi(optarg);
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-p procfs_root] [-j threads] [pattern...]\n", argv[0]);
+                return 2;
+        }
+    }
+
+    static const char *default_patterns[] = {"/libriru"};
+    maps::filter filter{maps::FILTER_CONTAINS, default_patterns, 1};
+    if (optind < argc) {
+        filter.patterns = argv + optind;
+        filter.count = (size_t) (argc - optind);
+    }
+
+    std::vector<process> processes;
+    if (!list_processes(processes)) return 2;
+
+    if (threads < 1) threads = 1;
+    if ((size_t) threads > processes.size()) threads = (int) processes.size();
+
+    // processes are taken one by one, a few huge maps do not hold up the others
+    std::atomic<size_t> next(0);
+    auto worker = [&]() {
+        size_t i;
+        while ((i = next.fetch_add(1)) < processes.size()) {
+            audit(processes[i], filter);
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for (int i = 1; i < threads; ++i) {
+        pool.emplace_back(worker);
+    }
+    worker();
+    for (auto &thread : pool) {
+        thread.join();
+    }
+
+    bool leaks = false, errors = false;
+    for (auto &p : processes) {
+        if (p.error) {
+            fprintf(stderr, "%d\t%s\n", p.pid, strerror(p.error));
+            errors = true;
+        }
+        if (!p.output.empty()) {
+            fputs(p.output.c_str(), stdout);
+            leaks = true;
+        }
+    }
+    return leaks ? 1 : (errors ? 2 : 0);
+}
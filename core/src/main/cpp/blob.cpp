@@ -0,0 +1,163 @@
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <map>
+#include <mutex>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#ifndef MFD_ALLOW_SEALING
+#include <linux/memfd.h>
+#endif
+
+#include "arena.h"
+#include "blob.h"
+#include "hide_utils.h"
+#include "logging.h"
+#include "status.h"
+#include "wrap.h"
+
+namespace blob {
+
+    namespace {
+        struct entry {
+            const void *data;
+            size_t size;
+        };
+    }
+
+    using blob_map = std::map<const char *, entry, arena::less_str,
+            arena::allocator<std::pair<const char *const, entry>>>;
+
+    // libriru is loaded in zygote, a forked process has another pid
+    static const pid_t zygote_pid = getpid();
+
+    static auto *blobs = arena::make<blob_map>();
+    static std::mutex blobs_mutex;
+
+    static bool can_publish(const char *name) {
+        if (!name || !*name) return false;
+
+        if (getpid() != zygote_pid) {
+            LOGW("blob %s: only zygote can publish", name);
+            return false;
+        }
+        if (blobs->find(name) != blobs->end()) {
+            LOGW("blob %s is published already", name);
+            return false;
+        }
+        return true;
+    }
+
+    static void add(const char *name, const void *data, size_t size) {
+        arena::scope writable;
+        blobs->emplace(arena::strdup(name), entry{data, size});
+        LOGD("blob %s: %zu bytes at %p", name, size, data);
+    }
+
+    /*
+     * Copy into a sealed memfd mapped shared and read-only: no process can write to it, not even
+     * through another mapping of the memfd, so its pages are never duplicated. Anonymous memory
+     * made read-only if memfd_create is not available (before Linux 3.17), the pages stay shared
+     * as long as nobody makes them writable again.
+     */
+    static void *copy_sealed(const void *data, size_t size) {
+        // memfd_create is only in bionic from API 30
+        auto fd = (int) syscall(__NR_memfd_create, HIDE_MEMFD_NAME, MFD_CLOEXEC | MFD_ALLOW_SEALING);
+        if (fd != -1) {
+            void *buffer = MAP_FAILED;
+            if (ftruncate(fd, (off_t) size) == -1) {
+                PLOGE("ftruncate");
+            } else {
+                buffer = _mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            }
+            if (buffer == MAP_FAILED) {
+                close(fd);
+                return nullptr;
+            }
+            memcpy(buffer, data, size);
+            // a writable shared mapping would prevent F_SEAL_WRITE
+            _munmap(buffer, size);
+
+            if (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) == -1) {
+                PLOGE("seal memfd");
+            }
+            buffer = _mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+            close(fd);
+            return buffer == MAP_FAILED ? nullptr : buffer;
+        }
+        PLOGE("memfd_create");
+
+        auto buffer = _mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (buffer == MAP_FAILED) return nullptr;
+        memcpy(buffer, data, size);
+        _mprotect(buffer, size, PROT_READ);
+        return buffer;
+    }
+
+    int publish(const char *name, const void *data, size_t size) {
+        if (!data || size == 0) return -1;
+
+        std::lock_guard<std::mutex> lock(blobs_mutex);
+        if (!can_publish(name)) return -1;
+
+        auto buffer = copy_sealed(data, size);
+        if (!buffer) {
+            LOGE("blob %s: failed to copy %zu bytes", name, size);
+            return -1;
+        }
+        add(name, buffer, size);
+        return 0;
+    }
+
+    int publish_file(const char *name, const char *path) {
+        if (!path) return -1;
+
+        std::lock_guard<std::mutex> lock(blobs_mutex);
+        if (!can_publish(name)) return -1;
+
+        int fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+            PLOGE("open %s", path);
+            return -1;
+        }
+        struct stat st{};
+        if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+            LOGE("blob %s: %s is not a regular file or is empty", name, path);
+            close(fd);
+            return -1;
+        }
+        auto size = (size_t) st.st_size;
+        auto file = _mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (file == MAP_FAILED) return -1;
+
+        // the mapping would show the path in the maps of every process
+        if (!status::getStatus()->hideEnabled) {
+            add(name, file, size);
+            return 0;
+        }
+
+        auto buffer = copy_sealed(file, size);
+        _munmap(file, size);
+        if (!buffer) {
+            LOGE("blob %s: failed to copy %s", name, path);
+            return -1;
+        }
+        add(name, buffer, size);
+        return 0;
+    }
+
+    const void *get(const char *name, size_t *size) {
+        if (!name) return nullptr;
+
+        std::lock_guard<std::mutex> lock(blobs_mutex);
+        auto it = blobs->find(name);
+        if (it == blobs->end()) return nullptr;
+
+        if (size) *size = it->second.size;
+        return it->second.data;
+    }
+}
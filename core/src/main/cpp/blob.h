@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstddef>
+
+/*
+ * Read-only data published by modules in zygote (tables, rules, dictionaries...) and read by
+ * every process forked from it. A blob is copied once into a sealed memfd mapped read-only, the
+ * children inherit the mapping: all of them share the same pages and nothing is parsed or
+ * copied again after fork.
+ */
+namespace blob {
+
+    /**
+     * Publish a copy of size bytes of data as name. Only in zygote, a name is published once.
+     * @return 0 on success, -1 otherwise
+     */
+    int publish(const char *name, const void *data, size_t size);
+
+    /**
+     * Publish the content of the file at path as name. The file is mapped directly (its pages
+     * are the page cache) unless hide is enabled, then it is copied like publish.
+     * @return 0 on success, -1 otherwise
+     */
+    int publish_file(const char *name, const char *path);
+
+    /**
+     * @return the blob published as name and its size, nullptr if there is none
+     */
+    const void *get(const char *name, size_t *size);
+}
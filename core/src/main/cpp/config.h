@@ -2,6 +2,8 @@
 
 #define CONFIG_DIR "/data/adb/riru"
 #define ENABLE_HIDE_FILE CONFIG_DIR "/enable_hide"
+#define HIDE_MODE_FILE CONFIG_DIR "/hide_mode"
+#define BACKGROUND_LOAD_FILE CONFIG_DIR "/background_load"
 
 #ifdef __LP64__
 #define LIB_PATH "/system/lib64/"
@@ -10,4 +12,6 @@
 #endif
 #define MODULE_PATH_FMT LIB_PATH "libriru_%s.so"
 
-#define MODULES_DIR CONFIG_DIR "/modules"
\ No newline at end of file
+#define MODULES_DIR CONFIG_DIR "/modules"
+// shared by zygote and zygote64, see manifest.h
+#define MODULES_MANIFEST_FILE CONFIG_DIR "/modules.manifest"
\ No newline at end of file
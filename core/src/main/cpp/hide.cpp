@@ -1,130 +1,226 @@
 #include <cinttypes>
+#include <fcntl.h>
+#include <unistd.h>
 #include <sys/mman.h>
-#include "pmparser.h"
+#include <sys/syscall.h>
+#ifndef MFD_ALLOW_SEALING
+#include <linux/memfd.h>
+#endif
+#include "hide_utils.h"
 #include "logging.h"
+#include "parallel_copy.h"
 #include "wrap.h"
 
 /**
  * Magic to hide from /proc/###/maps, the idea is from Haruue Icymoon (https://github.com/haruue)
  */
 
-#define EXPORT __attribute__((visibility("default"))) __attribute__((used))
+static inline bool is_accessible(const hide_range &range) {
+    return (range.prot & (PROT_READ | PROT_EXEC)) != 0;
+}
 
-extern "C" {
-int riru_hide(const char **names, int names_count) EXPORT;
+/*
+ * Copy the accessible segments of the image into buffer, the gaps reserved by the linker
+ * (no PROT_READ nor PROT_EXEC) are skipped. Large segments are copied on a few threads.
+ */
+static void copy_out(const hide_range *ranges, size_t count, uintptr_t buffer) {
+    auto start = ranges[0].start;
+    for (size_t i = 0; i < count; ++i) {
+        auto &range = ranges[i];
+        if (!is_accessible(range)) continue;
+
+        if (!(range.prot & PROT_READ)) {
+            LOGD("mprotect +r");
+            _mprotect((void *) range.start, range.end - range.start, range.prot | PROT_READ);
+        }
+        hide::parallel_copy((void *) (buffer + (range.start - start)), (void *) range.start, range.end - range.start);
+    }
 }
 
-#ifdef __LP64__
-#define LIB_PATH "/system/lib64/"
-#else
-#define LIB_PATH "/system/lib/"
-#endif
+/*
+ * Call f(first, last) for each run of segments with the same protection.
+ */
+template<typename F>
+static bool for_each_run(const hide_range *ranges, size_t count, F f) {
+    for (size_t i = 0; i < count;) {
+        size_t j = i + 1;
+        while (j < count && ranges[j].prot == ranges[i].prot) ++j;
+
+        if (!f(ranges[i], ranges[j - 1])) return false;
+        i = j;
+    }
+    return true;
+}
 
-struct hide_struct {
-    procmaps_struct *original;
-    uintptr_t backup_address;
-};
+/*
+ * HIDE_MODE_COPY: copy the image to a backup, replace the whole image with anonymous memory
+ * by one MAP_FIXED mmap, copy back and restore the protection of each run of segments.
+ */
+static int hide_image_copy(const hide_range *ranges, size_t count) {
+    auto start = ranges[0].start;
+    auto end = ranges[count - 1].end;
+    auto length = end - start;
 
-static int get_prot(const procmaps_struct *procstruct) {
-    int prot = 0;
-    if (procstruct->is_r) {
-        prot |= PROT_READ;
+    auto backup = (uintptr_t) _mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if (backup == (uintptr_t) MAP_FAILED) {
+        return 1;
     }
-    if (procstruct->is_w) {
-        prot |= PROT_WRITE;
+    LOGD("%" PRIxPTR"-%" PRIxPTR" is backup to %" PRIxPTR, start, end, backup);
+
+    copy_out(ranges, count, backup);
+
+    LOGD("mmap anonymous");
+    if (_mmap((void *) start, length, PROT_READ | PROT_WRITE, MAP_FIXED | MAP_ANONYMOUS | MAP_PRIVATE, -1, 0) == MAP_FAILED) {
+        _munmap((void *) backup, length);
+        return 1;
     }
-    if (procstruct->is_x) {
-        prot |= PROT_EXEC;
+
+    for (size_t i = 0; i < count; ++i) {
+        auto &range = ranges[i];
+        if (!is_accessible(range)) continue;
+
+        hide::parallel_copy((void *) range.start, (void *) (backup + (range.start - start)), range.end - range.start);
     }
-    return prot;
+
+    for_each_run(ranges, count, [](const hide_range &first, const hide_range &last) -> bool {
+        if (first.prot != (PROT_READ | PROT_WRITE)) {
+            _mprotect((void *) first.start, last.end - first.start, first.prot);
+        }
+        return true;
+    });
+
+    _munmap((void *) backup, length);
+    return 0;
 }
 
-static int do_hide(hide_struct *data) {
-    auto procstruct = data->original;
-    auto start = (uintptr_t) procstruct->addr_start;
-    auto end = (uintptr_t) procstruct->addr_end;
+/*
+ * HIDE_MODE_MREMAP: copy the image once into anonymous memory, give each run of segments its
+ * protection there and move the runs over the image with mremap. The file pages are dropped
+ * by the move and nothing is left to free, so the image costs its size once.
+ *
+ * mremap can only move a single vma, hence one call per run rather than one for the image.
+ *
+ * The code of a running image keeps working as each run is replaced by identical content at
+ * once, writable runs are copied again right before their move not to lose recent writes.
+ */
+static int hide_image_mremap(const hide_range *ranges, size_t count, bool running) {
+    auto start = ranges[0].start;
+    auto end = ranges[count - 1].end;
     auto length = end - start;
-    int prot = get_prot(procstruct);
 
-    // backup
-    data->backup_address = (uintptr_t) _mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
-    if (data->backup_address == (uintptr_t) MAP_FAILED) {
+    auto copy = (uintptr_t) _mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if (copy == (uintptr_t) MAP_FAILED) {
         return 1;
     }
-    LOGD("%" PRIxPTR"-%" PRIxPTR" %s %ld %s is backup to %" PRIxPTR, start, end, procstruct->perm, procstruct->offset, procstruct->pathname,
-         data->backup_address);
+    LOGD("%" PRIxPTR"-%" PRIxPTR" is copied to %" PRIxPTR, start, end, copy);
 
-    if (!procstruct->is_r) {
-        LOGD("mprotect +r");
-        _mprotect((void *) start, length, prot | PROT_READ);
-    }
-    LOGD("memcpy -> backup");
-    memcpy((void *) data->backup_address, (void *) start, length);
-
-    // munmap original
-    LOGD("munmap original");
-    munmap((void *) start, length);
-
-    // restore
-    LOGD("mmap original");
-    _mmap((void *) start, length, prot, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
-    LOGD("mprotect +w");
-    _mprotect((void *) start, length, prot | PROT_WRITE);
-    LOGD("memcpy -> original");
-    memcpy((void *) start, (void *) data->backup_address, length);
-    if (!procstruct->is_w) {
-        LOGD("mprotect -w");
-        _mprotect((void *) start, length, prot);
+    copy_out(ranges, count, copy);
+
+    for_each_run(ranges, count, [&](const hide_range &first, const hide_range &last) -> bool {
+        if (first.prot != (PROT_READ | PROT_WRITE)) {
+            _mprotect((void *) (copy + (first.start - start)), last.end - first.start, first.prot);
+        }
+        return true;
+    });
+
+    // the image stays mapped all the time, each run is replaced atomically
+    uintptr_t moved = start;
+    bool ok = for_each_run(ranges, count, [&](const hide_range &first, const hide_range &last) -> bool {
+        auto from = (void *) (copy + (first.start - start));
+        if (running && (first.prot & PROT_WRITE)) {
+            memcpy(from, (void *) first.start, last.end - first.start);
+        }
+        if (_mremap(from, last.end - first.start, last.end - first.start,
+                    MREMAP_MAYMOVE | MREMAP_FIXED, (void *) first.start) == MAP_FAILED) {
+            return false;
+        }
+        moved = last.end;
+        return true;
+    });
+
+    if (!ok) {
+        _munmap((void *) (copy + (moved - start)), end - moved);
+        return 1;
     }
     return 0;
 }
 
-int riru_hide(const char **names, int names_count) {
-    procmaps_iterator *maps = pmparser_parse(-1);
-    if (maps == nullptr) {
-        LOGE("cannot parse the memory map");
-        return false;
+/*
+ * HIDE_MODE_MEMFD: copy the image into a sealed memfd and map it over the image, shared for
+ * read-only/executable runs and private for writable ones. The pages are shmem, not anonymous:
+ * the copy is not duplicated by copy-on-write and is accounted (and reclaimed through swap)
+ * as shared memory.
+ */
+static int hide_image_memfd(const hide_range *ranges, size_t count) {
+    auto start = ranges[0].start;
+    auto end = ranges[count - 1].end;
+    auto length = end - start;
+
+    // memfd_create is only in bionic from API 30
+    auto fd = (int) syscall(__NR_memfd_create, HIDE_MEMFD_NAME, MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd == -1) {
+        PLOGE("memfd_create");
+        return 1;
+    }
+    if (ftruncate(fd, (off_t) length) == -1) {
+        PLOGE("ftruncate");
+        close(fd);
+        return 1;
     }
 
-    char buf[PATH_MAX];
-    hide_struct *data = nullptr;
-    size_t data_count = 0;
-    procmaps_struct *maps_tmp;
-    while ((maps_tmp = pmparser_next(maps)) != nullptr) {
-        bool matched = strcmp(maps_tmp->pathname, LIB_PATH "libriru.so") == 0;
-#ifdef DEBUG_APP
-        matched = strstr(maps_tmp->pathname, "libriru.so");
-#endif
-        if (!matched) {
-            for (int i = 0; i < names_count; ++i) {
-                snprintf(buf, PATH_MAX, LIB_PATH "libriru_%s.so", names[i]);
-                if (strcmp(maps_tmp->pathname, buf) == 0) {
-                    matched = true;
-                    break;
-                }
-            }
-        }
-        if (!matched) continue;
-
-        auto start = (uintptr_t) maps_tmp->addr_start;
-        auto end = (uintptr_t) maps_tmp->addr_end;
-        if (maps_tmp->is_r) {
-            if (data) {
-                data = (hide_struct *) realloc(data, sizeof(hide_struct) * (data_count + 1));
-            } else {
-                data = (hide_struct *) malloc(sizeof(hide_struct));
-            }
-            data[data_count].original = maps_tmp;
-            data_count += 1;
-        }
-        LOGD("%" PRIxPTR"-%" PRIxPTR" %s %ld %s", start, end, maps_tmp->perm, maps_tmp->offset, maps_tmp->pathname);
+    auto buffer = (uintptr_t) _mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (buffer == (uintptr_t) MAP_FAILED) {
+        close(fd);
+        return 1;
     }
+    LOGD("%" PRIxPTR"-%" PRIxPTR" is copied to memfd", start, end);
+    copy_out(ranges, count, buffer);
+    // a writable shared mapping would prevent F_SEAL_WRITE
+    _munmap((void *) buffer, length);
 
-    for (int i = 0; i < data_count; ++i) {
-        do_hide(&data[i]);
+    if (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) == -1) {
+        PLOGE("seal memfd");
     }
 
-    if (data) free(data);
-    pmparser_free(maps);
-    return 0;
-}
\ No newline at end of file
+    bool ok = for_each_run(ranges, count, [&](const hide_range &first, const hide_range &last) -> bool {
+        int flags = MAP_FIXED | (first.prot & PROT_WRITE ? MAP_PRIVATE : MAP_SHARED);
+        return _mmap((void *) first.start, last.end - first.start, first.prot, flags, fd,
+                     (off_t) (first.start - start)) != MAP_FAILED;
+    });
+    close(fd);
+    return ok ? 0 : 1;
+}
+
+int hide::hide_images(const hide_range *ranges, size_t count, hide_mode mode, bool running) {
+    int res = 0;
+    for (size_t i = 0; i < count;) {
+        size_t j = i + 1;
+        while (j < count && ranges[j].start == ranges[j - 1].end) ++j;
+
+        LOGD("hide %" PRIxPTR"-%" PRIxPTR" (%zu segments)", ranges[i].start, ranges[j - 1].end, j - i);
+        int image_res = 1;
+        if (running) {
+            // never unmapped, not even for a moment
+            image_res = hide_image_mremap(ranges + i, j - i, true);
+            if (image_res != 0) LOGE("cannot hide a running image");
+            res |= image_res;
+            i = j;
+            continue;
+        }
+        if (mode == HIDE_MODE_MEMFD) {
+            image_res = hide_image_memfd(ranges + i, j - i);
+            if (image_res != 0) LOGW("memfd hide failed, fallback to mremap");
+        }
+        if (image_res != 0 && mode != HIDE_MODE_COPY) {
+            image_res = hide_image_mremap(ranges + i, j - i, false);
+            if (image_res != 0) LOGW("mremap hide failed, fallback to copy");
+        }
+        if (image_res != 0) {
+            // also fine if some runs are anonymous already
+            image_res = hide_image_copy(ranges + i, j - i);
+        }
+        if (image_res != 0) res = 1;
+        i = j;
+    }
+    return res;
+}
@@ -0,0 +1,364 @@
+#include <atomic>
+#include <cerrno>
+#include <cinttypes>
+#include <csignal>
+#include <cstring>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/userfaultfd.h>
+#include "hide_lazy.h"
+#include "logging.h"
+#include "wrap.h"
+
+#ifndef UFFD_USER_MODE_ONLY
+#define UFFD_USER_MODE_ONLY 1
+#endif
+
+/*
+ * There is no thread to serve the faults: zygote waits for being single threaded before each
+ * fork. With UFFD_FEATURE_SIGBUS a missing page raises SIGBUS on the faulting thread instead,
+ * and the handler copies the page in.
+ *
+ * The kernel does not raise the signal for its own accesses (e.g. a syscall reading a buffer),
+ * they fail with EFAULT. Only executable segments are left lazy for that reason, data and
+ * read-only data are filled at hide.
+ */
+
+namespace hide {
+
+    namespace {
+        struct lazy_range {
+            uintptr_t start;
+            uintptr_t end;
+            int prot;
+            // where the content of start is
+            uintptr_t source;
+        };
+
+        struct lazy_image {
+            uintptr_t start;
+            uintptr_t end;
+            uintptr_t backup;
+        };
+    }
+
+    // fixed size, the fault handler cannot allocate
+    static constexpr size_t MAX_IMAGES = 64;
+    static constexpr size_t MAX_RANGES = 256;
+
+    static lazy_image images[MAX_IMAGES];
+    static size_t image_count = 0;
+
+    static lazy_range lazy_ranges[MAX_RANGES];
+    static std::atomic<size_t> lazy_range_count(0);
+    static std::atomic<size_t> fault_count(0);
+
+    static int uffd = -1;
+    static uintptr_t page_size = 0;
+    static struct sigaction old_action;
+
+    static inline bool is_accessible(const hide_range &range) {
+        return (range.prot & (PROT_READ | PROT_EXEC)) != 0;
+    }
+
+    /*
+     * UFFDIO_COPY [src, src + length) to dst, pages already there are skipped.
+     */
+    static int copy_pages(uintptr_t dst, uintptr_t src, size_t length) {
+        size_t done = 0;
+        while (done < length) {
+            uffdio_copy copy{};
+            copy.dst = dst + done;
+            copy.src = src + done;
+            copy.len = length - done;
+            if (ioctl(uffd, UFFDIO_COPY, &copy) == 0) return 0;
+
+            // copy.copy is the length copied before the error, or the error
+            if (copy.copy > 0) {
+                done += (size_t) copy.copy;
+            } else if (errno == EEXIST) {
+                done += page_size;
+            } else if (errno != EAGAIN) {
+                return -1;
+            }
+        }
+        return 0;
+    }
+
+    static void on_sigbus(int sig, siginfo_t *info, void *context);
+
+    /*
+     * Put back the SIGBUS action replaced by init(), unless a module or ART installed its own
+     * since then (which may chain to ours).
+     * @return false if the current action is not ours
+     */
+    static bool restore_action() {
+        struct sigaction current{};
+        if (sigaction(SIGBUS, nullptr, &current) == -1
+            || !(current.sa_flags & SA_SIGINFO) || current.sa_sigaction != on_sigbus) {
+            return false;
+        }
+        sigaction(SIGBUS, &old_action, nullptr);
+        return true;
+    }
+
+    static void on_sigbus(int sig, siginfo_t *info, void *context) {
+        int saved_errno = errno;
+        auto address = (uintptr_t) info->si_addr;
+
+        auto count = lazy_range_count.load(std::memory_order_acquire);
+        for (size_t i = 0; i < count; ++i) {
+            auto &range = lazy_ranges[i];
+            if (address < range.start || address >= range.end) continue;
+
+            auto page = address & ~(page_size - 1);
+            if (copy_pages(page, range.source + (page - range.start), page_size) == 0) {
+                fault_count.fetch_add(1, std::memory_order_relaxed);
+                errno = saved_errno;
+                return;
+            }
+            break;
+        }
+        errno = saved_errno;
+
+        // not ours
+        if (old_action.sa_flags & SA_SIGINFO) {
+            old_action.sa_sigaction(sig, info, context);
+        } else if (old_action.sa_handler == SIG_DFL || old_action.sa_handler == SIG_IGN) {
+            // the access faults again and gets the default action, even if a handler installed
+            // after ours chained here: the process is terminated by the fault anyway
+            if (!restore_action()) {
+                struct sigaction action{};
+                action.sa_handler = SIG_DFL;
+                sigaction(SIGBUS, &action, nullptr);
+            }
+        } else {
+            old_action.sa_handler(sig);
+        }
+    }
+
+    static bool init() {
+        if (uffd != -1) return true;
+
+        page_size = (uintptr_t) sysconf(_SC_PAGESIZE);
+
+        // user mode only (Linux 5.11) does not need vm.unprivileged_userfaultfd
+        uffd = (int) syscall(__NR_userfaultfd, O_CLOEXEC | O_NONBLOCK | UFFD_USER_MODE_ONLY);
+        if (uffd == -1 && errno == EINVAL) {
+            uffd = (int) syscall(__NR_userfaultfd, O_CLOEXEC | O_NONBLOCK);
+        }
+        if (uffd == -1) {
+            PLOGE("userfaultfd");
+            return false;
+        }
+
+        uffdio_api api{};
+        api.api = UFFD_API;
+        api.features = UFFD_FEATURE_SIGBUS;
+        if (ioctl(uffd, UFFDIO_API, &api) == -1) {
+            PLOGE("UFFDIO_API");
+            close(uffd);
+            uffd = -1;
+            return false;
+        }
+
+        struct sigaction action{};
+        action.sa_sigaction = on_sigbus;
+        action.sa_flags = SA_SIGINFO | SA_ONSTACK | SA_RESTART;
+        sigemptyset(&action.sa_mask);
+        if (sigaction(SIGBUS, &action, &old_action) == -1) {
+            PLOGE("sigaction");
+            close(uffd);
+            uffd = -1;
+            return false;
+        }
+
+        // covers every way zygote forks, including the ones Riru has no hook for
+        static bool atfork = false;
+        if (!atfork) {
+            pthread_atfork(lazy_finish, nullptr, nullptr);
+            atfork = true;
+        }
+        return true;
+    }
+
+    /*
+     * Move the first count ranges back from backup and drop backup.
+     */
+    static void restore(const hide_range *ranges, size_t count, uintptr_t backup) {
+        auto start = ranges[0].start;
+        for (size_t i = 0; i < count; ++i) {
+            auto &range = ranges[i];
+            auto length = range.end - range.start;
+            if (is_accessible(range)) {
+                _mremap((void *) (backup + (range.start - start)), length, length,
+                        MREMAP_MAYMOVE | MREMAP_FIXED, (void *) range.start);
+            } else {
+                // the gap may have been mapped over
+                _mprotect((void *) range.start, length, range.prot);
+            }
+        }
+        _munmap((void *) backup, ranges[count - 1].end - start);
+    }
+
+    /*
+     * Move the segments of the image into a backup reservation (no copy, the pages stay in the
+     * page cache), map anonymous memory over the image and register it.
+     * @return false with the image as before on failure
+     */
+    static bool hide_image(const hide_range *ranges, size_t count) {
+        auto start = ranges[0].start;
+        auto end = ranges[count - 1].end;
+        auto length = end - start;
+
+        size_t accessible = 0;
+        for (size_t i = 0; i < count; ++i) {
+            if (is_accessible(ranges[i])) accessible++;
+        }
+        if (image_count == MAX_IMAGES || lazy_range_count.load() + accessible > MAX_RANGES) {
+            LOGW("too many images for lazy hide");
+            return false;
+        }
+
+        auto backup = (uintptr_t) _mmap(nullptr, length, PROT_NONE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+        if (backup == (uintptr_t) MAP_FAILED) {
+            return false;
+        }
+
+        size_t moved = 0;
+        for (; moved < count; ++moved) {
+            auto &range = ranges[moved];
+            if (!is_accessible(range)) continue;
+
+            auto to = backup + (range.start - start);
+            auto size = range.end - range.start;
+            if (_mremap((void *) range.start, size, size, MREMAP_MAYMOVE | MREMAP_FIXED, (void *) to) == MAP_FAILED) {
+                restore(ranges, moved, backup);
+                return false;
+            }
+            // UFFDIO_COPY reads the source
+            if (!(range.prot & PROT_READ)) {
+                _mprotect((void *) to, size, range.prot | PROT_READ);
+            }
+        }
+        LOGD("%" PRIxPTR"-%" PRIxPTR" is moved to %" PRIxPTR, start, end, backup);
+
+        if (_mmap((void *) start, length, PROT_READ | PROT_WRITE, MAP_FIXED | MAP_ANONYMOUS | MAP_PRIVATE, -1, 0) == MAP_FAILED) {
+            restore(ranges, count, backup);
+            return false;
+        }
+
+        uffdio_register reg{};
+        reg.range.start = start;
+        reg.range.len = length;
+        reg.mode = UFFDIO_REGISTER_MODE_MISSING;
+        if (ioctl(uffd, UFFDIO_REGISTER, &reg) == -1) {
+            PLOGE("UFFDIO_REGISTER");
+            restore(ranges, count, backup);
+            return false;
+        }
+        images[image_count++] = {start, end, backup};
+
+        // published before anything can touch the image
+        auto n = lazy_range_count.load();
+        for (size_t i = 0; i < count; ++i) {
+            auto &range = ranges[i];
+            if (range.prot & PROT_EXEC) {
+                lazy_ranges[n++] = {range.start, range.end, range.prot, backup + (range.start - start)};
+            }
+        }
+        lazy_range_count.store(n, std::memory_order_release);
+
+        for (size_t i = 0; i < count; ++i) {
+            auto &range = ranges[i];
+            if (!is_accessible(range) || (range.prot & PROT_EXEC)) continue;
+
+            auto source = backup + (range.start - start);
+            if (copy_pages(range.start, source, range.end - range.start) == -1) {
+                PLOGE("UFFDIO_COPY %" PRIxPTR, range.start);
+                // filled on touch or at finish then
+                lazy_ranges[n++] = {range.start, range.end, range.prot, source};
+                lazy_range_count.store(n, std::memory_order_release);
+            }
+        }
+
+        for (size_t i = 0; i < count;) {
+            size_t j = i + 1;
+            while (j < count && ranges[j].prot == ranges[i].prot) ++j;
+
+            if (ranges[i].prot != (PROT_READ | PROT_WRITE)) {
+                _mprotect((void *) ranges[i].start, ranges[j - 1].end - ranges[i].start, ranges[i].prot);
+            }
+            i = j;
+        }
+        return true;
+    }
+
+    void lazy_hide(const hide_range *ranges, size_t count) {
+        bool available = init();
+        if (!available) LOGW("userfaultfd is not available, fallback to mremap");
+
+        for (size_t i = 0; i < count;) {
+            size_t j = i + 1;
+            while (j < count && ranges[j].start == ranges[j - 1].end) ++j;
+
+            LOGD("lazy hide %" PRIxPTR"-%" PRIxPTR" (%zu segments)", ranges[i].start, ranges[j - 1].end, j - i);
+            if (!available || !hide_image(ranges + i, j - i)) {
+                if (available) LOGW("lazy hide failed, fallback to mremap");
+                hide_images(ranges + i, j - i, HIDE_MODE_MREMAP);
+            }
+            i = j;
+        }
+    }
+
+    void lazy_finish() {
+        if (uffd == -1) return;
+
+        auto count = lazy_range_count.load(std::memory_order_acquire);
+        LOGD("lazy hide finish, %zu pages were faulted in", fault_count.load());
+
+        bool failed[MAX_RANGES] = {};
+        for (size_t i = 0; i < count; ++i) {
+            auto &range = lazy_ranges[i];
+            if (copy_pages(range.start, range.source, range.end - range.start) == -1) {
+                PLOGE("UFFDIO_COPY %" PRIxPTR, range.start);
+                failed[i] = true;
+            }
+        }
+
+        for (size_t i = 0; i < image_count; ++i) {
+            uffdio_range range{};
+            range.start = images[i].start;
+            range.len = images[i].end - images[i].start;
+            if (ioctl(uffd, UFFDIO_UNREGISTER, &range) == -1) {
+                PLOGE("UFFDIO_UNREGISTER %" PRIxPTR, images[i].start);
+            }
+        }
+
+        // missing pages are plain anonymous memory now
+        for (size_t i = 0; i < count; ++i) {
+            if (!failed[i]) continue;
+
+            auto &range = lazy_ranges[i];
+            auto length = range.end - range.start;
+            _mprotect((void *) range.start, length, range.prot | PROT_READ | PROT_WRITE);
+            memcpy((void *) range.start, (void *) range.source, length);
+            _mprotect((void *) range.start, length, range.prot);
+        }
+
+        for (size_t i = 0; i < image_count; ++i) {
+            _munmap((void *) images[i].backup, images[i].end - images[i].start);
+        }
+
+        if (!restore_action()) LOGW("SIGBUS handler was replaced, left in place");
+        close(uffd);
+        uffd = -1;
+        image_count = 0;
+        lazy_range_count.store(0);
+        fault_count.store(0);
+    }
+}
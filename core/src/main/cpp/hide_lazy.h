@@ -0,0 +1,28 @@
+#pragma once
+
+#include "hide_utils.h"
+
+namespace hide {
+
+    /**
+     * Hide the images of ranges without copying their code: each image is replaced by anonymous
+     * memory registered to userfaultfd, non-executable segments are filled at once and the pages
+     * of executable ones are copied from the moved file mapping on first touch (SIGBUS handler).
+     *
+     * Images which cannot be hidden this way (no userfaultfd, too many images) are hidden with
+     * HIDE_MODE_MREMAP instead.
+     *
+     * The code running the fault handler (libriru) must not be hidden this way.
+     */
+    void lazy_hide(const hide_range *ranges, size_t count);
+
+    /**
+     * Fill the pages not touched yet and drop the moved file mappings, runs before every fork
+     * as a child would not get the registration. Nothing to do if lazy_hide was not used.
+     *
+     * The first fork is system_server's, right after boot: from then on the images are fully
+     * resident as with HIDE_MODE_MREMAP, lazy only moves the copy out of the hide and overlaps
+     * it with the startup of zygote.
+     */
+    void lazy_finish();
+}
@@ -1,6 +1,12 @@
-#include <sys/mman.h>
-#include <dlfcn.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstdio>
+#include <climits>
+#include <string>
+#include <unordered_set>
+#include <vector>
 #include "hide_utils.h"
+#include "hide_lazy.h"
 #include "wrap.h"
 #include "logging.h"
 
@@ -16,47 +22,108 @@
 
 namespace hide {
 
-    void hide_modules(const char **names, int names_count) {
-        // load riruhide.so and run the hide
-        LOGD("dlopen libriruhide");
-        auto handle = dlopen(LIB_PATH "libriruhide.so", 0);
-        if (!handle) {
-            LOGE("dlopen %s failed: %s", LIB_PATH "libriruhide.so", dlerror());
-            return;
+    enum target {
+        TARGET_NONE,
+        TARGET_RIRU,
+        TARGET_MODULE
+    };
+
+    /*
+     * Mark the path ids of libriru and the modules, each path is looked up once.
+     */
+    static void mark_targets(const maps::snapshot &snapshot, const char **names, int names_count,
+                             std::vector<uint8_t> &targets) {
+        targets.assign(snapshot.path_count(), TARGET_NONE);
+#ifndef DEBUG_APP
+        auto mark = [&](const char *path, target value) {
+            auto id = snapshot.find_path(path);
+            if (id != maps::snapshot::NO_PATH) targets[id] = value;
+        };
+        mark(LIB_PATH "libriru.so", TARGET_RIRU);
+
+        char path[PATH_MAX];
+        for (int i = 0; i < names_count; ++i) {
+            snprintf(path, PATH_MAX, LIB_PATH "libriru_%s.so", names[i]);
+            mark(path, TARGET_MODULE);
         }
-        using riru_hide_t = int(const char **names, int names_count);
-        auto *riru_hide = (riru_hide_t *) dlsym(handle, "riru_hide");
-        if (!riru_hide) {
-            LOGE("dlsym failed: %s", dlerror());
-            return;
+#else
+        // libraries of the app are mapped from their real path, match file names
+        std::unordered_set<std::string> modules;
+        char name[PATH_MAX];
+        for (int i = 0; i < names_count; ++i) {
+            snprintf(name, PATH_MAX, "libriru_%s.so", names[i]);
+            modules.emplace(name);
         }
+        for (uint32_t id = 1; id < snapshot.path_count(); ++id) {
+            auto slash = strrchr(snapshot.path(id), '/');
+            if (!slash) continue;
+            if (strcmp(slash + 1, "libriru.so") == 0) targets[id] = TARGET_RIRU;
+            else if (modules.count(slash + 1)) targets[id] = TARGET_MODULE;
+        }
+#endif
+    }
 
-        LOGD("do hide");
-        riru_hide(names, names_count);
+    void collect(const maps::snapshot &snapshot, const char **names, int names_count,
+                 std::vector<hide_range> &riru, std::vector<hide_range> &modules) {
+        std::vector<uint8_t> targets;
+        mark_targets(snapshot, names, names_count, targets);
 
-        // cleanup riruhide.so
-        LOGD("dlclose");
-        if (dlclose(handle) != 0) {
-            LOGE("dlclose failed: %s", dlerror());
-            return;
+        // one pass whatever the number of modules, ranges come sorted
+        for (size_t i = 0; i < snapshot.size(); ++i) {
+            auto value = targets[snapshot.path_id(i)];
+            if (value == TARGET_NONE) continue;
+
+            LOGD("%" PRIxPTR"-%" PRIxPTR" %" PRIx64" %s", snapshot.start(i), snapshot.end(i),
+                 snapshot.offset(i), snapshot.path(snapshot.path_id(i)));
+
+            // all segments, inaccessible gaps as well, so an image is hidden at once
+            (value == TARGET_RIRU ? riru : modules).push_back({snapshot.start(i), snapshot.end(i), snapshot.prot(i)});
         }
+    }
+
+    hide_mode read_mode(const char *path) {
+        char buf[16] = {};
+        int fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd == -1) return HIDE_MODE_MREMAP;
+
+        read(fd, buf, sizeof(buf) - 1);
+        close(fd);
+        buf[strcspn(buf, "\r\n")] = '\0';
+
+        if (strcmp(buf, "copy") == 0) return HIDE_MODE_COPY;
+        if (strcmp(buf, "memfd") == 0) return HIDE_MODE_MEMFD;
+        if (strcmp(buf, "lazy") == 0) return HIDE_MODE_LAZY;
+        if (strcmp(buf, "mremap") != 0) LOGW("unknown hide mode %s", buf);
+        return HIDE_MODE_MREMAP;
+    }
 
-        procmaps_iterator *maps = pmparser_parse(-1);
-        if (maps == nullptr) {
+    void hide_modules(maps::snapshot &snapshot, const char **names, int names_count, hide_mode mode, bool hide_riru) {
+        if (snapshot.ensure() == -1) {
             LOGE("cannot parse the memory map");
             return;
         }
 
-        procmaps_struct *maps_tmp;
-        while ((maps_tmp = pmparser_next(maps)) != nullptr) {
-            if (!strstr(maps_tmp->pathname, "/libriruhide.so")) continue;
+        std::vector<hide_range> riru, modules;
+        collect(snapshot, names, names_count, riru, modules);
+        if (!hide_riru) riru.clear();
+
+        LOGD("do hide (mode %d)", mode);
+        if (mode == HIDE_MODE_LAZY) {
+            lazy_hide(modules.data(), modules.size());
+        } else {
+            hide_images(modules.data(), modules.size(), mode);
+        }
 
-            auto start = (uintptr_t) maps_tmp->addr_start;
-            auto end = (uintptr_t) maps_tmp->addr_end;
-            auto size = end - start;
-            LOGV("%" PRIxPTR"-%" PRIxPTR" %s %ld %s", start, end, maps_tmp->perm, maps_tmp->offset, maps_tmp->pathname);
-            munmap((void *) start, size);
+        // last, this code is in libriru
+        hide_images(riru.data(), riru.size(), HIDE_MODE_MREMAP, true);
+
+        // hidden ranges are anonymous now, the file mappings moved aside by a lazy hide are not
+        // tracked, they are gone before the first fork
+        for (auto &range : modules) {
+            snapshot.mapped(range.start, range.end, range.prot);
+        }
+        for (auto &range : riru) {
+            snapshot.mapped(range.start, range.end, range.prot);
         }
-        pmparser_free(maps);
     }
-}
\ No newline at end of file
+}
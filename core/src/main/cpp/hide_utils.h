@@ -2,10 +2,63 @@
 #define RIRU_HIDE_UTILS_H
 
 #include <cinttypes>
-#include "pmparser.h"
+#include <vector>
+#include "maps_snapshot.h"
+
+// what ART names its own memfd, maps show "/memfd:jit-zygote-cache (deleted)"
+#define HIDE_MEMFD_NAME "jit-zygote-cache"
+
+/**
+ * A mapping to be hidden, ranges are sorted and contiguous ones are hidden together.
+ */
+struct hide_range {
+    uintptr_t start;
+    uintptr_t end;
+    int prot;
+};
+
+/**
+ * How hide_images replaces the pages, read from HIDE_MODE_FILE ("copy", "mremap", "memfd" or
+ * "lazy"). A failed mode falls back to the one before it, lazy falls back to mremap.
+ */
+enum hide_mode {
+    // copy the image out and back into anonymous memory mapped over it
+    HIDE_MODE_COPY,
+    // copy once into anonymous memory and move it over the image with mremap
+    HIDE_MODE_MREMAP,
+    // copy once into a sealed memfd mapped over the image
+    HIDE_MODE_MEMFD,
+    // fill the pages of module code on first touch (hide_lazy.h), libriru as mremap
+    HIDE_MODE_LAZY
+};
 
 namespace hide {
 
-    void hide_modules(const char **names, int names_count);
+    /**
+     * @return the mode named in the first line of the file, HIDE_MODE_MREMAP if absent or unknown
+     */
+    hide_mode read_mode(const char *path);
+
+    /**
+     * Replace the images of ranges with anonymous memory of the same content and protection.
+     * Images which are running (their code is on the stack, e.g. libriru) are only replaced
+     * run by run with an identical copy (HIDE_MODE_MREMAP), whatever the mode.
+     * @return 0 if all images were hidden
+     */
+    int hide_images(const hide_range *ranges, size_t count, hide_mode mode, bool running = false);
+
+    /**
+     * Append all segments of libriru to riru and those of the modules named in names to modules,
+     * in address order.
+     */
+    void collect(const maps::snapshot &snapshot, const char **names, int names_count,
+                 std::vector<hide_range> &riru, std::vector<hide_range> &modules);
+
+    /**
+     * Hide the modules, then libriru itself unless hide_riru is false, using the shared snapshot,
+     * which is taken here if not yet and kept up to date.
+     */
+    void hide_modules(maps::snapshot &snapshot, const char **names, int names_count, hide_mode mode,
+                      bool hide_riru = true);
 }
 #endif //RIRU_HIDE_UTILS_H
@@ -0,0 +1,145 @@
+#include <pthread.h>
+#include <unistd.h>
+#include "init_pool.h"
+#include "logging.h"
+
+namespace init_pool {
+
+    static constexpr int MAX_THREADS = 8;
+
+    namespace {
+        enum task_state {
+            WAITING, RUNNING, DONE
+        };
+
+        struct pool {
+            std::vector<task> &tasks;
+            std::vector<task_state> states;
+            size_t done;
+            size_t running;
+            // next serial task, only the calling thread runs them
+            size_t next_serial;
+            pthread_mutex_t mutex;
+            pthread_cond_t cond;
+        };
+    }
+
+    static bool is_ready(const pool &p, size_t i) {
+        if (p.states[i] != WAITING) return false;
+        // a serial task starts after all tasks before it, as when they were all serial
+        if (!p.tasks[i].parallel) {
+            for (size_t j = 0; j < i; ++j) {
+                if (p.states[j] != DONE) return false;
+            }
+        }
+        for (auto j : p.tasks[i].after) {
+            if (p.states[j] != DONE) return false;
+        }
+        return true;
+    }
+
+    /*
+     * @return index of a task this thread can start, or tasks.size() if there is none for now
+     */
+    static size_t pick(pool &p, bool caller) {
+        auto count = p.tasks.size();
+
+        if (caller) {
+            while (p.next_serial < count && (p.tasks[p.next_serial].parallel || p.states[p.next_serial] != WAITING)) {
+                p.next_serial++;
+            }
+            if (p.next_serial < count && is_ready(p, p.next_serial)) return p.next_serial;
+        }
+
+        for (size_t i = 0; i < count; ++i) {
+            if (p.tasks[i].parallel && is_ready(p, i)) return i;
+        }
+
+        // nothing runs and nothing is ready: the rest waits for each other
+        if (caller && p.running == 0 && p.done < count) {
+            for (size_t i = 0; i < count; ++i) {
+                if (p.states[i] == WAITING) {
+                    LOGW("dependency cycle, task %zu starts first", i);
+                    return i;
+                }
+            }
+        }
+        return count;
+    }
+
+    static void work(pool &p, bool caller) {
+        auto count = p.tasks.size();
+
+        pthread_mutex_lock(&p.mutex);
+        while (p.done < count) {
+            auto i = pick(p, caller);
+            if (i == count) {
+                pthread_cond_wait(&p.cond, &p.mutex);
+                continue;
+            }
+
+            p.states[i] = RUNNING;
+            p.running++;
+            pthread_mutex_unlock(&p.mutex);
+
+            p.tasks[i].run(p.tasks[i].arg);
+
+            pthread_mutex_lock(&p.mutex);
+            p.states[i] = DONE;
+            p.running--;
+            p.done++;
+            pthread_cond_broadcast(&p.cond);
+        }
+        pthread_mutex_unlock(&p.mutex);
+    }
+
+    static void *work_thread(void *arg) {
+        work(*(pool *) arg, false);
+        return nullptr;
+    }
+
+    void run(std::vector<task> &tasks, int threads) {
+        auto count = tasks.size();
+        if (count == 0) return;
+
+        size_t parallel = 0;
+        for (size_t i = 0; i < count; ++i) {
+            auto &after = tasks[i].after;
+            for (auto it = after.begin(); it != after.end();) {
+                if (*it >= count || *it == i) {
+                    it = after.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+            if (tasks[i].parallel) parallel++;
+        }
+
+        if (threads <= 0) {
+            threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+        }
+        if (threads > MAX_THREADS) threads = MAX_THREADS;
+        // the calling thread takes one of the parallel tasks
+        if ((size_t) threads > parallel) threads = (int) parallel;
+
+        pool p{tasks, std::vector<task_state>(count, WAITING), 0, 0, 0,
+               PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER};
+
+        pthread_t workers[MAX_THREADS];
+        int started = 0;
+        for (; started < threads - 1; ++started) {
+            if (pthread_create(&workers[started], nullptr, work_thread, &p) != 0) {
+                LOGW("pthread_create failed, run with %d threads", started + 1);
+                break;
+            }
+        }
+
+        work(p, true);
+
+        for (int i = 0; i < started; ++i) {
+            pthread_join(workers[i], nullptr);
+        }
+        pthread_mutex_destroy(&p.mutex);
+        pthread_cond_destroy(&p.cond);
+    }
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+namespace init_pool {
+
+    struct task {
+        void (*run)(void *arg);
+        void *arg;
+        // may run on another thread, concurrently with other parallel tasks
+        bool parallel;
+        // indexes of the tasks which have to finish first
+        std::vector<size_t> after;
+    };
+
+    /**
+     * Run all tasks. Serial tasks run in order on the calling thread, parallel ones on up to
+     * threads - 1 temporary threads (0 for one per online CPU, at most 8) and on the calling
+     * thread when it has nothing else to do. A task starts only after the tasks of its after
+     * list, and a serial task only after all tasks before it, parallel ones included. A
+     * dependency cycle is broken by starting its first task anyway.
+     *
+     * All threads are joined before returning, the process is as single threaded as it was.
+     */
+    void run(std::vector<task> &tasks, int threads = 0);
+}
@@ -8,6 +8,7 @@
 #include "module.h"
 #include "api.h"
 #include "main.h"
+#include "jni_predicate.h"
 
 namespace JNI {
 
@@ -24,6 +25,19 @@ namespace JNI {
     }
 }
 
+// nice name of the process being forked, for the on-demand modules
+static char process_name[256];
+
+static void save_process_name(JNIEnv *env, jstring name) {
+    process_name[0] = '\0';
+    if (!name || !process_name_needed()) return;
+
+    auto chars = env->GetStringUTFChars(name, nullptr);
+    if (!chars) return;
+    strncpy(process_name, chars, sizeof(process_name) - 1);
+    env->ReleaseStringUTFChars(name, chars);
+}
+
 static int shouldSkipUid(int uid) {
     int appId = uid % 100000;
 
@@ -42,6 +56,10 @@ static void nativeForkAndSpecialize_pre(
         jstring &instructionSet, jstring &appDataDir, jboolean &isTopApp, jobjectArray &pkgDataInfoList,
         jobjectArray &whitelistedDataInfoList, jboolean &bindMountAppDataDirs, jboolean &bindMountAppStorageDirs) {
 
+    wait_for_modules();
+    load_new_modules();
+    save_process_name(env, se_name);
+
     for (auto module : *get_modules()) {
         if (!module->hasForkAndSpecializePre())
             continue;
@@ -62,10 +80,14 @@ static void nativeForkAndSpecialize_pre(
 
 static void nativeForkAndSpecialize_post(JNIEnv *env, jclass clazz, jint uid, jint res) {
 
-    if (res == 0) restore_replaced_func(env);
+    if (res == 0) {
+        restore_replaced_func(env);
+        load_on_demand_modules(process_name);
+        trim_modules(process_name);
+    }
 
     for (auto module : *get_modules()) {
-        if (!module->hasForkAndSpecializePost())
+        if (!module->hasForkAndSpecializePost() || module->trimmed)
             continue;
 
         if (module->hasShouldSkipUid() && module->shouldSkipUid(uid))
@@ -101,6 +123,9 @@ static void nativeSpecializeAppProcess_pre(
         jboolean &isTopApp, jobjectArray &pkgDataInfoList, jobjectArray &whitelistedDataInfoList,
         jboolean &bindMountAppDataDirs, jboolean &bindMountAppStorageDirs) {
 
+    wait_for_modules();
+    save_process_name(env, niceName);
+
     for (auto module : *get_modules()) {
         if (!module->hasSpecializeAppProcessPre())
             continue;
@@ -115,9 +140,11 @@ static void nativeSpecializeAppProcess_pre(
 static void nativeSpecializeAppProcess_post(JNIEnv *env, jclass clazz) {
 
     restore_replaced_func(env);
+    load_on_demand_modules(process_name);
+    trim_modules(process_name);
 
     for (auto module : *get_modules()) {
-        if (!module->hasSpecializeAppProcessPost())
+        if (!module->hasSpecializeAppProcessPost() || module->trimmed)
             continue;
 
         LOGD("%s: specializeAppProcessPost", module->name);
@@ -131,6 +158,9 @@ static void nativeForkSystemServer_pre(
         JNIEnv *env, jclass clazz, uid_t &uid, gid_t &gid, jintArray &gids, jint &debug_flags,
         jobjectArray &rlimits, jlong &permittedCapabilities, jlong &effectiveCapabilities) {
 
+    wait_for_modules();
+    load_new_modules();
+
     for (auto module : *get_modules()) {
         if (!module->hasForkSystemServerPre())
             continue;
@@ -142,8 +172,13 @@ static void nativeForkSystemServer_pre(
 }
 
 static void nativeForkSystemServer_post(JNIEnv *env, jclass clazz, jint res) {
+    if (res == 0) {
+        load_on_demand_modules("system_server");
+        trim_modules("system_server");
+    }
+
     for (auto module : *get_modules()) {
-        if (!module->hasForkSystemServerPost())
+        if (!module->hasForkSystemServerPost() || module->trimmed)
             continue;
 
         if (res == 0) LOGD("%s: forkSystemServerPost", module->name);
@@ -153,6 +188,7 @@ static void nativeForkSystemServer_post(JNIEnv *env, jclass clazz, jint res) {
 
 // -----------------------------------------------------------------
 
+#if RIRU_FOR_SDK(23, 25)
 jint nativeForkAndSpecialize_marshmallow(
         JNIEnv *env, jclass clazz, jint uid, jint gid, jintArray gids, jint debug_flags,
         jobjectArray rlimits, jint mount_external, jstring se_info, jstring se_name,
@@ -178,7 +214,9 @@ jint nativeForkAndSpecialize_marshmallow(
     nativeForkAndSpecialize_post(env, clazz, uid, res);
     return res;
 }
+#endif
 
+#if RIRU_FOR_SDK(24, 27)
 jint nativeForkAndSpecialize_oreo(
         JNIEnv *env, jclass clazz, jint uid, jint gid, jintArray gids, jint debug_flags,
         jobjectArray rlimits, jint mount_external, jstring se_info, jstring se_name,
@@ -203,7 +241,9 @@ jint nativeForkAndSpecialize_oreo(
     nativeForkAndSpecialize_post(env, clazz, uid, res);
     return res;
 }
+#endif
 
+#if RIRU_FOR_SDK(28, 29)
 jint nativeForkAndSpecialize_p(
         JNIEnv *env, jclass clazz, jint uid, jint gid, jintArray gids, jint runtime_flags,
         jobjectArray rlimits, jint mount_external, jstring se_info, jstring se_name,
@@ -228,7 +268,9 @@ jint nativeForkAndSpecialize_p(
     nativeForkAndSpecialize_post(env, clazz, uid, res);
     return res;
 }
+#endif
 
+#if RIRU_FOR_SDK(29, 29)
 jint nativeForkAndSpecialize_q_alternative(
         JNIEnv *env, jclass clazz, jint uid, jint gid, jintArray gids, jint runtime_flags,
         jobjectArray rlimits, jint mount_external, jstring se_info, jstring se_name,
@@ -252,7 +294,9 @@ jint nativeForkAndSpecialize_q_alternative(
     nativeForkAndSpecialize_post(env, clazz, uid, res);
     return res;
 }
+#endif
 
+#if RIRU_FOR_SDK(29, RIRU_SDK_LATEST)
 jint nativeForkAndSpecialize_r(
         JNIEnv *env, jclass clazz, jint uid, jint gid, jintArray gids, jint runtime_flags,
         jobjectArray rlimits, jint mount_external, jstring se_info, jstring se_name,
@@ -273,7 +317,9 @@ jint nativeForkAndSpecialize_r(
     nativeForkAndSpecialize_post(env, clazz, uid, res);
     return res;
 }
+#endif
 
+#if RIRU_FOR_SDK(29, 30)
 jint nativeForkAndSpecialize_r_dp3(
         JNIEnv *env, jclass clazz, jint uid, jint gid, jintArray gids, jint runtime_flags,
         jobjectArray rlimits, jint mount_external, jstring se_info, jstring se_name,
@@ -297,7 +343,9 @@ jint nativeForkAndSpecialize_r_dp3(
     nativeForkAndSpecialize_post(env, clazz, uid, res);
     return res;
 }
+#endif
 
+#if RIRU_FOR_SDK(29, 30)
 jint nativeForkAndSpecialize_r_dp2(
         JNIEnv *env, jclass clazz, jint uid, jint gid, jintArray gids, jint runtime_flags,
         jobjectArray rlimits, jint mount_external, jstring se_info, jstring se_name,
@@ -320,7 +368,9 @@ jint nativeForkAndSpecialize_r_dp2(
     nativeForkAndSpecialize_post(env, clazz, uid, res);
     return res;
 }
+#endif
 
+#if RIRU_FOR_SDK(28, 28)
 jint nativeForkAndSpecialize_samsung_p(
         JNIEnv *env, jclass clazz, jint uid, jint gid, jintArray gids, jint runtime_flags,
         jobjectArray rlimits, jint mount_external, jstring se_info, jint category, jint accessInfo,
@@ -346,7 +396,9 @@ jint nativeForkAndSpecialize_samsung_p(
     nativeForkAndSpecialize_post(env, clazz, uid, res);
     return res;
 }
+#endif
 
+#if RIRU_FOR_SDK(26, 27)
 jint nativeForkAndSpecialize_samsung_o(
         JNIEnv *env, jclass clazz, jint uid, jint gid, jintArray gids, jint debug_flags,
         jobjectArray rlimits, jint mount_external, jstring se_info, jint category, jint accessInfo,
@@ -372,7 +424,9 @@ jint nativeForkAndSpecialize_samsung_o(
     nativeForkAndSpecialize_post(env, clazz, uid, res);
     return res;
 }
+#endif
 
+#if RIRU_FOR_SDK(24, 25)
 jint nativeForkAndSpecialize_samsung_n(
         JNIEnv *env, jclass clazz, jint uid, jint gid, jintArray gids, jint debug_flags,
         jobjectArray rlimits, jint mount_external, jstring se_info, jint category, jint accessInfo,
@@ -399,7 +453,9 @@ jint nativeForkAndSpecialize_samsung_n(
     nativeForkAndSpecialize_post(env, clazz, uid, res);
     return res;
 }
+#endif
 
+#if RIRU_FOR_SDK(23, 23)
 jint nativeForkAndSpecialize_samsung_m(
         JNIEnv *env, jclass clazz, jint uid, jint gid, jintArray gids, jint debug_flags,
         jobjectArray rlimits, jint mount_external, jstring se_info, jint category, jint accessInfo,
@@ -425,9 +481,11 @@ jint nativeForkAndSpecialize_samsung_m(
     nativeForkAndSpecialize_post(env, clazz, uid, res);
     return res;
 }
+#endif
 
 // -----------------------------------------------------------------
 
+#if RIRU_FOR_SDK(29, 29)
 void nativeSpecializeAppProcess_q(
         JNIEnv *env, jclass clazz, jint uid, jint gid, jintArray gids, jint runtimeFlags,
         jobjectArray rlimits, jint mountExternal, jstring seInfo, jstring niceName,
@@ -450,7 +508,9 @@ void nativeSpecializeAppProcess_q(
 
     nativeSpecializeAppProcess_post(env, clazz);
 }
+#endif
 
+#if RIRU_FOR_SDK(29, 29)
 void nativeSpecializeAppProcess_q_alternative(
         JNIEnv *env, jclass clazz, jint uid, jint gid, jintArray gids, jint runtimeFlags,
         jobjectArray rlimits, jint mountExternal, jstring seInfo, jstring niceName,
@@ -473,7 +533,9 @@ void nativeSpecializeAppProcess_q_alternative(
 
     nativeSpecializeAppProcess_post(env, clazz);
 }
+#endif
 
+#if RIRU_FOR_SDK(29, RIRU_SDK_LATEST)
 void nativeSpecializeAppProcess_r(
         JNIEnv *env, jclass clazz, jint uid, jint gid, jintArray gids, jint runtimeFlags,
         jobjectArray rlimits, jint mountExternal, jstring seInfo, jstring niceName,
@@ -493,7 +555,9 @@ void nativeSpecializeAppProcess_r(
 
     nativeSpecializeAppProcess_post(env, clazz);
 }
+#endif
 
+#if RIRU_FOR_SDK(29, 30)
 void nativeSpecializeAppProcess_r_dp3(
         JNIEnv *env, jclass clazz, jint uid, jint gid, jintArray gids, jint runtimeFlags,
         jobjectArray rlimits, jint mountExternal, jstring seInfo, jstring niceName,
@@ -515,7 +579,9 @@ void nativeSpecializeAppProcess_r_dp3(
 
     nativeSpecializeAppProcess_post(env, clazz);
 }
+#endif
 
+#if RIRU_FOR_SDK(29, 30)
 void nativeSpecializeAppProcess_r_dp2(
         JNIEnv *env, jclass clazz, jint uid, jint gid, jintArray gids, jint runtimeFlags,
         jobjectArray rlimits, jint mountExternal, jstring seInfo, jstring niceName,
@@ -537,8 +603,10 @@ void nativeSpecializeAppProcess_r_dp2(
 
     nativeSpecializeAppProcess_post(env, clazz);
 }
+#endif
 
 
+#if RIRU_FOR_SDK(29, 29)
 void nativeSpecializeAppProcess_samsung_q(
         JNIEnv *env, jclass clazz, jint uid, jint gid, jintArray gids, jint runtimeFlags,
         jobjectArray rlimits, jint mountExternal, jstring seInfo, jint space, jint accessInfo,
@@ -561,6 +629,7 @@ void nativeSpecializeAppProcess_samsung_q(
 
     nativeSpecializeAppProcess_post(env, clazz);
 }
+#endif
 
 // -----------------------------------------------------------------
 
@@ -580,6 +649,7 @@ jint nativeForkSystemServer(
     return res;
 }
 
+#if RIRU_FOR_SDK(29, 29)
 jint nativeForkSystemServer_samsung_q(
         JNIEnv *env, jclass cls, uid_t uid, gid_t gid, jintArray gids, jint runtimeFlags,
         jint space, jint accessInfo, jobjectArray rlimits, jlong permittedCapabilities,
@@ -596,6 +666,7 @@ jint nativeForkSystemServer_samsung_q(
     nativeForkSystemServer_post(env, cls, res);
     return res;
 }
+#endif
 
 /*
  * On Android 9+, in very rare cases, SystemProperties.set("sys.user." + userId + ".ce_available", "true")
@@ -613,10 +684,11 @@ jint nativeForkSystemServer_samsung_q(
  * -> http://androidxref.com/9.0.0_r3/xref/system/vold/Ext4Crypt.cpp#221
  */
 void SystemProperties_set(JNIEnv *env, jobject clazz, jstring keyJ, jstring valJ) {
-    const char *key = env->GetStringUTFChars(keyJ, JNI_FALSE);
-    char user[16];
-    int no_throw = sscanf(key, "sys.user.%[^.].ce_available", user) == 1;
-    env->ReleaseStringUTFChars(keyJ, key);
+    jstring args[] = {keyJ, valJ};
+    predicate::dispatch(predicate::SystemProperties::set, env, args);
+
+    // sys.user.<id>.ce_available
+    bool no_throw = predicate::match_segment(env, keyJ, "sys.user.", ".ce_available");
 
     ((SystemProperties_set_t *) JNI::SystemProperties::set->fnPtr)(env, clazz, keyJ, valJ);
 
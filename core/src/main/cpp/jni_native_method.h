@@ -4,6 +4,20 @@
 #include <jni.h>
 #include <riru.h>
 
+/*
+ * A build for some API levels only (RIRU_SDK_MIN to RIRU_SDK_MAX, set by CMakeLists.txt) has
+ * the replacements for the signatures of those levels only. The generic build has all of them.
+ */
+#ifndef RIRU_SDK_MIN
+#define RIRU_SDK_MIN 0
+#endif
+#ifndef RIRU_SDK_MAX
+#define RIRU_SDK_MAX RIRU_SDK_LATEST
+#endif
+// signatures which are still in use by the latest Android
+#define RIRU_SDK_LATEST 10000
+#define RIRU_FOR_SDK(min, max) (RIRU_SDK_MIN <= (max) && RIRU_SDK_MAX >= (min))
+
 namespace JNI {
 
     namespace Zygote {
@@ -19,6 +33,7 @@ namespace JNI {
     }
 }
 
+#if RIRU_FOR_SDK(23, 25)
 const static char *nativeForkAndSpecialize_marshmallow_sig = "(II[II[[IILjava/lang/String;Ljava/lang/String;[ILjava/lang/String;Ljava/lang/String;)I";
 
 using nativeForkAndSpecialize_marshmallow_t = jint(
@@ -29,7 +44,9 @@ jint nativeForkAndSpecialize_marshmallow(
         JNIEnv *env, jclass clazz, jint uid, jint gid, jintArray gids, jint debug_flags,
         jobjectArray rlimits, jint mount_external, jstring se_info, jstring se_name,
         jintArray fdsToClose, jstring instructionSet, jstring appDataDir);
+#endif
 
+#if RIRU_FOR_SDK(24, 27)
 const static char *nativeForkAndSpecialize_oreo_sig = "(II[II[[IILjava/lang/String;Ljava/lang/String;[I[ILjava/lang/String;Ljava/lang/String;)I";
 
 using nativeForkAndSpecialize_oreo_t = jint(
@@ -40,7 +57,9 @@ jint nativeForkAndSpecialize_oreo(
         JNIEnv *env, jclass clazz, jint uid, jint gid, jintArray gids, jint debug_flags,
         jobjectArray rlimits, jint mount_external, jstring se_info, jstring se_name,
         jintArray fdsToClose, jintArray fdsToIgnore, jstring instructionSet, jstring appDataDir);
+#endif
 
+#if RIRU_FOR_SDK(28, 29)
 const static char *nativeForkAndSpecialize_p_sig = "(II[II[[IILjava/lang/String;Ljava/lang/String;[I[IZLjava/lang/String;Ljava/lang/String;)I";
 
 using nativeForkAndSpecialize_p_t = jint(
@@ -52,7 +71,9 @@ jint nativeForkAndSpecialize_p(
         jobjectArray rlimits, jint mount_external, jstring se_info, jstring se_name,
         jintArray fdsToClose, jintArray fdsToIgnore, jboolean is_child_zygote,
         jstring instructionSet, jstring appDataDir);
+#endif
 
+#if RIRU_FOR_SDK(29, 29)
 const static char *nativeForkAndSpecialize_q_alternative_sig = "(II[II[[IILjava/lang/String;Ljava/lang/String;[I[IZLjava/lang/String;Ljava/lang/String;Z)I";
 
 using nativeForkAndSpecialize_q_alternative_t = jint(
@@ -64,7 +85,9 @@ jint nativeForkAndSpecialize_q_alternative(
         jobjectArray rlimits, jint mount_external, jstring se_info, jstring se_name,
         jintArray fdsToClose, jintArray fdsToIgnore, jboolean is_child_zygote,
         jstring instructionSet, jstring appDataDir, jboolean isTopApp);
+#endif
 
+#if RIRU_FOR_SDK(29, RIRU_SDK_LATEST)
 const static char *nativeForkAndSpecialize_r_sig = "(II[II[[IILjava/lang/String;Ljava/lang/String;[I[IZLjava/lang/String;Ljava/lang/String;Z[Ljava/lang/String;[Ljava/lang/String;ZZ)I";
 
 using nativeForkAndSpecialize_r_t = jint(
@@ -78,7 +101,9 @@ jint nativeForkAndSpecialize_r(
         jintArray fdsToClose, jintArray fdsToIgnore, jboolean is_child_zygote,
         jstring instructionSet, jstring appDataDir, jboolean isTopApp, jobjectArray pkgDataInfoList,
         jobjectArray whitelistedDataInfoList, jboolean bindMountAppDataDirs, jboolean bindMountAppStorageDirs);
+#endif
 
+#if RIRU_FOR_SDK(29, 30)
 const static char *nativeForkAndSpecialize_r_dp2_sig = "(II[II[[IILjava/lang/String;Ljava/lang/String;[I[IZLjava/lang/String;Ljava/lang/String;Z[Ljava/lang/String;)I";
 
 using nativeForkAndSpecialize_r_dp2_t = jint(
@@ -90,7 +115,9 @@ jint nativeForkAndSpecialize_r_dp2(
         jobjectArray rlimits, jint mount_external, jstring se_info, jstring se_name,
         jintArray fdsToClose, jintArray fdsToIgnore, jboolean is_child_zygote,
         jstring instructionSet, jstring appDataDir, jboolean isTopApp, jobjectArray pkgDataInfoList);
+#endif
 
+#if RIRU_FOR_SDK(29, 30)
 const static char *nativeForkAndSpecialize_r_dp3_sig = "(II[II[[IILjava/lang/String;Ljava/lang/String;[I[IZLjava/lang/String;Ljava/lang/String;Z[Ljava/lang/String;Z)I";
 
 using nativeForkAndSpecialize_r_dp3_t = jint(
@@ -103,7 +130,9 @@ jint nativeForkAndSpecialize_r_dp3(
         jintArray fdsToClose, jintArray fdsToIgnore, jboolean is_child_zygote,
         jstring instructionSet, jstring appDataDir, jboolean isTopApp, jobjectArray pkgDataInfoList,
         jboolean bindMountAppStorageDirs);
+#endif
 
+#if RIRU_FOR_SDK(28, 28)
 const static char *nativeForkAndSpecialize_samsung_p_sig = "(II[II[[IILjava/lang/String;IILjava/lang/String;[I[IZLjava/lang/String;Ljava/lang/String;)I";
 
 using nativeForkAndSpecialize_samsung_p_t = jint(
@@ -115,7 +144,9 @@ jint nativeForkAndSpecialize_samsung_p(
         jobjectArray rlimits, jint mount_external, jstring se_info, jint category, jint accessInfo,
         jstring se_name, jintArray fdsToClose, jintArray fdsToIgnore, jboolean is_child_zygote,
         jstring instructionSet, jstring appDataDir);
+#endif
 
+#if RIRU_FOR_SDK(26, 27)
 const static char *nativeForkAndSpecialize_samsung_o_sig = "(II[II[[IILjava/lang/String;IILjava/lang/String;[I[ILjava/lang/String;Ljava/lang/String;)I";
 
 using nativeForkAndSpecialize_samsung_o_t = jint(
@@ -127,7 +158,9 @@ jint nativeForkAndSpecialize_samsung_o(
         jobjectArray rlimits, jint mount_external, jstring se_info, jint category, jint accessInfo,
         jstring se_name, jintArray fdsToClose, jintArray fdsToIgnore, jstring instructionSet,
         jstring appDataDir);
+#endif
 
+#if RIRU_FOR_SDK(24, 25)
 const static char *nativeForkAndSpecialize_samsung_n_sig = "(II[II[[IILjava/lang/String;IILjava/lang/String;[ILjava/lang/String;Ljava/lang/String;I)I";
 
 using nativeForkAndSpecialize_samsung_n_t = jint(
@@ -138,7 +171,9 @@ jint nativeForkAndSpecialize_samsung_n(
         JNIEnv *env, jclass clazz, jint uid, jint gid, jintArray gids, jint debug_flags,
         jobjectArray rlimits, jint mount_external, jstring se_info, jint category, jint accessInfo,
         jstring se_name, jintArray fdsToClose, jstring instructionSet, jstring appDataDir, jint);
+#endif
 
+#if RIRU_FOR_SDK(23, 23)
 const static char *nativeForkAndSpecialize_samsung_m_sig = "(II[II[[IILjava/lang/String;IILjava/lang/String;[ILjava/lang/String;Ljava/lang/String;)I";
 
 using nativeForkAndSpecialize_samsung_m_t = jint(
@@ -149,9 +184,11 @@ jint nativeForkAndSpecialize_samsung_m(
         JNIEnv *env, jclass clazz, jint uid, jint gid, jintArray gids, jint debug_flags,
         jobjectArray rlimits, jint mount_external, jstring se_info, jint category, jint accessInfo,
         jstring se_name, jintArray fdsToClose, jstring instructionSet, jstring appDataDir);
+#endif
 
 // -----------------------------------------------------------------
 
+#if RIRU_FOR_SDK(29, 29)
 const static char *nativeSpecializeAppProcess_q_sig = "(II[II[[IILjava/lang/String;Ljava/lang/String;ZLjava/lang/String;Ljava/lang/String;)V";
 
 using nativeSpecializeAppProcess_q_t = void(
@@ -162,7 +199,9 @@ void nativeSpecializeAppProcess_q(
         JNIEnv *env, jclass clazz, jint uid, jint gid, jintArray gids, jint runtimeFlags,
         jobjectArray rlimits, jint mountExternal, jstring seInfo, jstring niceName,
         jboolean startChildZygote, jstring instructionSet, jstring appDataDir);
+#endif
 
+#if RIRU_FOR_SDK(29, RIRU_SDK_LATEST)
 const static char *nativeSpecializeAppProcess_r_sig = "(II[II[[IILjava/lang/String;Ljava/lang/String;ZLjava/lang/String;Ljava/lang/String;Z[Ljava/lang/String;[Ljava/lang/String;ZZ)V";
 
 using nativeSpecializeAppProcess_r_t = void(
@@ -175,7 +214,9 @@ void nativeSpecializeAppProcess_r(
         jboolean startChildZygote, jstring instructionSet, jstring appDataDir,
         jboolean isTopApp, jobjectArray pkgDataInfoList, jobjectArray whitelistedDataInfoList,
         jboolean bindMountAppDataDirs, jboolean bindMountAppStorageDirs);
+#endif
 
+#if RIRU_FOR_SDK(29, 30)
 const static char *nativeSpecializeAppProcess_r_dp2_sig = "(II[II[[IILjava/lang/String;Ljava/lang/String;ZLjava/lang/String;Ljava/lang/String;Z[Ljava/lang/String;)V";
 
 using nativeSpecializeAppProcess_r_dp2_t = void(
@@ -187,7 +228,9 @@ void nativeSpecializeAppProcess_r_dp2(
         jobjectArray rlimits, jint mountExternal, jstring seInfo, jstring niceName,
         jboolean startChildZygote, jstring instructionSet, jstring appDataDir,
         jboolean isTopApp, jobjectArray pkgDataInfoList);
+#endif
 
+#if RIRU_FOR_SDK(29, 30)
 const static char *nativeSpecializeAppProcess_r_dp3_sig = "(II[II[[IILjava/lang/String;Ljava/lang/String;ZLjava/lang/String;Ljava/lang/String;Z[Ljava/lang/String;Z)V";
 
 using nativeSpecializeAppProcess_r_dp3_t = void(
@@ -199,7 +242,9 @@ void nativeSpecializeAppProcess_r_dp3(
         jobjectArray rlimits, jint mountExternal, jstring seInfo, jstring niceName,
         jboolean startChildZygote, jstring instructionSet, jstring appDataDir,
         jboolean isTopApp, jobjectArray pkgDataInfoList, jboolean bindMountAppStorageDirs);
+#endif
 
+#if RIRU_FOR_SDK(29, 29)
 const static char *nativeSpecializeAppProcess_q_alternative_sig = "(II[II[[IILjava/lang/String;Ljava/lang/String;ZLjava/lang/String;Ljava/lang/String;Z)V";
 
 using nativeSpecializeAppProcess_q_alternative_t = void(
@@ -211,7 +256,9 @@ void nativeSpecializeAppProcess_q_alternative(
         jobjectArray rlimits, jint mountExternal, jstring seInfo, jstring niceName,
         jboolean startChildZygote, jstring instructionSet, jstring appDataDir,
         jboolean isTopApp);
+#endif
 
+#if RIRU_FOR_SDK(29, 29)
 const static char *nativeSpecializeAppProcess_sig_samsung_q = "(II[II[[IILjava/lang/String;IILjava/lang/String;ZLjava/lang/String;Ljava/lang/String;)V";
 
 using nativeSpecializeAppProcess_samsung_t = void(
@@ -222,6 +269,7 @@ void nativeSpecializeAppProcess_samsung_q(
         JNIEnv *env, jclass clazz, jint uid, jint gid, jintArray gids, jint runtimeFlags,
         jobjectArray rlimits, jint mountExternal, jstring seInfo, jint space, jint accessInfo,
         jstring niceName, jboolean startChildZygote, jstring instructionSet, jstring appDataDir);
+#endif
 
 // -----------------------------------------------------------------
 
@@ -234,6 +282,7 @@ jint nativeForkSystemServer(
         JNIEnv *env, jclass, uid_t uid, gid_t gid, jintArray gids, jint runtimeFlags,
         jobjectArray rlimits, jlong permittedCapabilities, jlong effectiveCapabilities);
 
+#if RIRU_FOR_SDK(29, 29)
 const static char *nativeForkSystemServer_samsung_q_sig = "(II[IIII[[IJJ)I";
 
 using nativeForkSystemServer_samsung_q_t = jint(
@@ -243,6 +292,7 @@ jint nativeForkSystemServer_samsung_q(
         JNIEnv *env, jclass, uid_t uid, gid_t gid, jintArray gids, jint runtimeFlags,
         jint space, jint accessInfo, jobjectArray rlimits, jlong permittedCapabilities,
         jlong effectiveCapabilities);
+#endif
 
 // -----------------------------------------------------------------
 
@@ -0,0 +1,139 @@
+#include <cstring>
+#include <mutex>
+#include "jni_predicate.h"
+#include "logging.h"
+
+namespace predicate {
+
+    namespace SystemProperties {
+        Interposer set{"android/os/SystemProperties", "native_set", "(Ljava/lang/String;Ljava/lang/String;)V", 2,
+                       {nullptr}};
+    }
+
+    static Interposer *interposers[] = {
+            &SystemProperties::set
+    };
+
+    // serializes add and remove, modules with a parallel onModuleLoaded may add concurrently
+    static std::mutex predicates_mutex;
+
+#define REGION_SIZE 32
+
+    static bool region_equals(JNIEnv *env, jstring str, jsize start, const char *s, size_t length) {
+        jchar buf[REGION_SIZE];
+        while (length > 0) {
+            auto count = (jsize) (length < REGION_SIZE ? length : REGION_SIZE);
+            env->GetStringRegion(str, start, count, buf);
+            for (jsize i = 0; i < count; ++i) {
+                if (buf[i] != (unsigned char) s[i]) return false;
+            }
+            start += count;
+            s += count;
+            length -= count;
+        }
+        return true;
+    }
+
+    bool match(JNIEnv *env, jstring str, const char *prefix, size_t prefixLength,
+               const char *suffix, size_t suffixLength) {
+        if (str == nullptr) return false;
+
+        auto length = (size_t) env->GetStringLength(str);
+        if (length < prefixLength + suffixLength) return false;
+
+        return region_equals(env, str, 0, prefix, prefixLength)
+               && region_equals(env, str, (jsize) (length - suffixLength), suffix, suffixLength);
+    }
+
+    bool match_segment(JNIEnv *env, jstring str, const char *prefix, size_t prefixLength,
+                       const char *suffix, size_t suffixLength) {
+        if (!match(env, str, prefix, prefixLength, suffix, suffixLength)) return false;
+
+        auto start = (jsize) prefixLength;
+        auto end = env->GetStringLength(str) - (jsize) suffixLength;
+        if (start >= end) return false;
+
+        jchar buf[REGION_SIZE];
+        while (start < end) {
+            auto count = end - start < REGION_SIZE ? end - start : REGION_SIZE;
+            env->GetStringRegion(str, start, count, buf);
+            for (jsize i = 0; i < count; ++i) {
+                if (buf[i] == '.') return false;
+            }
+            start += count;
+        }
+        return true;
+    }
+
+    Interposer *find(const char *className, const char *name, const char *signature) {
+        if (!className || !name || !signature) return nullptr;
+
+        for (auto interposer : interposers) {
+            if (strcmp(interposer->className, className) == 0
+                && strcmp(interposer->name, name) == 0
+                && strcmp(interposer->signature, signature) == 0)
+                return interposer;
+        }
+        return nullptr;
+    }
+
+    static bool is_ascii(const char *str) {
+        for (; *str; ++str) {
+            if ((unsigned char) *str >= 0x80) return false;
+        }
+        return true;
+    }
+
+    int add(Interposer *interposer, uint32_t token, int index, const char *prefix, const char *suffix,
+            RiruStringPredicateCallback_v10 *callback) {
+        if (!prefix) prefix = "";
+        if (!suffix) suffix = "";
+
+        if (index < 0 || index >= interposer->argc || !callback) return -1;
+
+        if (!is_ascii(prefix) || !is_ascii(suffix)) {
+            LOGW("string predicate %s...%s is not ASCII", prefix, suffix);
+            return -1;
+        }
+
+        std::lock_guard<std::mutex> lock(predicates_mutex);
+        auto current = interposer->predicates.load();
+        auto predicates = current ? new std::vector<StringPredicate>(*current) : new std::vector<StringPredicate>();
+        predicates->push_back(
+                {token, index, strdup(prefix), strlen(prefix), strdup(suffix), strlen(suffix), callback});
+        interposer->predicates.store(predicates, std::memory_order_release);
+        return 0;
+    }
+
+    void remove(uint32_t token) {
+        std::lock_guard<std::mutex> lock(predicates_mutex);
+        for (auto interposer : interposers) {
+            auto current = interposer->predicates.load();
+            if (!current) continue;
+
+            auto predicates = new std::vector<StringPredicate>();
+            for (auto &predicate : *current) {
+                if (predicate.token != token) predicates->push_back(predicate);
+            }
+            if (predicates->size() == current->size()) {
+                delete predicates;
+                continue;
+            }
+            interposer->predicates.store(predicates, std::memory_order_release);
+        }
+    }
+
+    void dispatch(const Interposer &interposer, JNIEnv *env, const jstring *args) {
+        // a callback adding predicates publishes a new list, this one stays valid
+        auto predicates = interposer.predicates.load(std::memory_order_acquire);
+        if (!predicates || predicates->empty()) return;
+
+        for (auto &predicate : *predicates) {
+            if (!match(env, args[predicate.index], predicate.prefix, predicate.prefixLength,
+                       predicate.suffix, predicate.suffixLength))
+                continue;
+
+            predicate.callback(env, args, interposer.argc);
+        }
+    }
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <atomic>
+#include <jni.h>
+#include <riru.h>
+#include <vector>
+
+/**
+ * Cheap checks of jstring arguments of interposed JNI methods.
+ *
+ * Strings are compared chunk by chunk with GetStringRegion, so there is no UTF
+ * conversion and no allocation. Patterns must be ASCII.
+ */
+namespace predicate {
+
+    struct StringPredicate {
+        // of the module which added it
+        uint32_t token;
+        int index;
+        const char *prefix;
+        size_t prefixLength;
+        const char *suffix;
+        size_t suffixLength;
+        RiruStringPredicateCallback_v10 *callback;
+    };
+
+    struct Interposer {
+        const char *className;
+        const char *name;
+        const char *signature;
+        int argc;
+        // replaced as a whole by add and remove, never freed: dispatch reads it without a lock
+        std::atomic<const std::vector<StringPredicate> *> predicates;
+    };
+
+    namespace SystemProperties {
+        extern Interposer set;
+    }
+
+    bool match(JNIEnv *env, jstring str, const char *prefix, size_t prefixLength,
+               const char *suffix, size_t suffixLength);
+
+    template<size_t P, size_t S>
+    inline bool match(JNIEnv *env, jstring str, const char (&prefix)[P], const char (&suffix)[S]) {
+        return match(env, str, prefix, P - 1, suffix, S - 1);
+    }
+
+    /**
+     * match, and what is between prefix and suffix is one non-empty segment without '.', like
+     * "%[^.]" of scanf.
+     */
+    bool match_segment(JNIEnv *env, jstring str, const char *prefix, size_t prefixLength,
+                       const char *suffix, size_t suffixLength);
+
+    template<size_t P, size_t S>
+    inline bool match_segment(JNIEnv *env, jstring str, const char (&prefix)[P], const char (&suffix)[S]) {
+        return match_segment(env, str, prefix, P - 1, suffix, S - 1);
+    }
+
+    Interposer *find(const char *className, const char *name, const char *signature);
+
+    int add(Interposer *interposer, uint32_t token, int index, const char *prefix, const char *suffix,
+            RiruStringPredicateCallback_v10 *callback);
+
+    /**
+     * Drop the predicates added by the module of token from all interposers, before its callbacks
+     * go away (the module is unloaded) or must not run anymore (the module is trimmed).
+     */
+    void remove(uint32_t token);
+
+    /**
+     * Run callbacks of matched predicates, args must have interposer->argc elements.
+     */
+    void dispatch(const Interposer &interposer, JNIEnv *env, const jstring *args);
+}
@@ -1,3 +1,6 @@
+#include <functional>
+#include <vector>
+#include <pthread.h>
 #include <xhook/xhook.h>
 #include <sys/system_properties.h>
 #include "misc.h"
@@ -10,11 +13,130 @@
 #include "hide_utils.h"
 #include "status.h"
 #include "config.h"
+#include "jni_predicate.h"
+#include "arena.h"
 
 static int sdkLevel;
 static int previewSdkLevel;
 static char androidVersionName[PROP_VALUE_MAX + 1];
 
+// modules are loaded on this thread while zygote starts
+static pthread_t loader;
+static bool loading = false;
+// what the hooks leave for after the modules are loaded, as they run meanwhile
+static auto *deferred = new std::vector<std::function<void()>>();
+
+/*
+ * Run f now, or after the modules are loaded if they are still loading. Anything using the
+ * modules or the status from a hook goes through here.
+ */
+template<typename F>
+static void after_modules_loaded(F f) {
+    if (loading) {
+        deferred->emplace_back(f);
+    } else {
+        f();
+    }
+}
+
+static void *load_in_background(void *) {
+    load_modules(true);
+    status::writeToFile();
+    return nullptr;
+}
+
+void wait_for_modules() {
+    if (loading) {
+        pthread_join(loader, nullptr);
+        loading = false;
+        LOGI("modules loaded in background");
+
+        hide_riru();
+
+        for (auto &f : *deferred) {
+            f();
+        }
+        deferred->clear();
+    }
+
+    // zygote is initialized, a label would show Riru in the maps if it is to be hidden
+    arena::freeze(status::getStatus()->hideEnabled ? nullptr : "riru");
+}
+
+namespace {
+    struct method_replacement {
+        const char *signature;
+        void *fnPtr;
+    };
+}
+
+// only the signatures of the API levels this library is built for, see RIRU_FOR_SDK
+static const method_replacement nativeForkAndSpecialize_replacements[] = {
+#if RIRU_FOR_SDK(29, RIRU_SDK_LATEST)
+        {nativeForkAndSpecialize_r_sig, (void *) nativeForkAndSpecialize_r},
+#endif
+#if RIRU_FOR_SDK(28, 29)
+        {nativeForkAndSpecialize_p_sig, (void *) nativeForkAndSpecialize_p},
+#endif
+#if RIRU_FOR_SDK(24, 27)
+        {nativeForkAndSpecialize_oreo_sig, (void *) nativeForkAndSpecialize_oreo},
+#endif
+#if RIRU_FOR_SDK(23, 25)
+        {nativeForkAndSpecialize_marshmallow_sig, (void *) nativeForkAndSpecialize_marshmallow},
+#endif
+#if RIRU_FOR_SDK(29, 30)
+        {nativeForkAndSpecialize_r_dp3_sig, (void *) nativeForkAndSpecialize_r_dp3},
+        {nativeForkAndSpecialize_r_dp2_sig, (void *) nativeForkAndSpecialize_r_dp2},
+#endif
+#if RIRU_FOR_SDK(29, 29)
+        {nativeForkAndSpecialize_q_alternative_sig, (void *) nativeForkAndSpecialize_q_alternative},
+#endif
+#if RIRU_FOR_SDK(28, 28)
+        {nativeForkAndSpecialize_samsung_p_sig, (void *) nativeForkAndSpecialize_samsung_p},
+#endif
+#if RIRU_FOR_SDK(26, 27)
+        {nativeForkAndSpecialize_samsung_o_sig, (void *) nativeForkAndSpecialize_samsung_o},
+#endif
+#if RIRU_FOR_SDK(24, 25)
+        {nativeForkAndSpecialize_samsung_n_sig, (void *) nativeForkAndSpecialize_samsung_n},
+#endif
+#if RIRU_FOR_SDK(23, 23)
+        {nativeForkAndSpecialize_samsung_m_sig, (void *) nativeForkAndSpecialize_samsung_m},
+#endif
+        {nullptr, nullptr}
+};
+
+static const method_replacement nativeSpecializeAppProcess_replacements[] = {
+#if RIRU_FOR_SDK(29, RIRU_SDK_LATEST)
+        {nativeSpecializeAppProcess_r_sig, (void *) nativeSpecializeAppProcess_r},
+#endif
+#if RIRU_FOR_SDK(29, 29)
+        {nativeSpecializeAppProcess_q_sig, (void *) nativeSpecializeAppProcess_q},
+        {nativeSpecializeAppProcess_q_alternative_sig, (void *) nativeSpecializeAppProcess_q_alternative},
+        {nativeSpecializeAppProcess_sig_samsung_q, (void *) nativeSpecializeAppProcess_samsung_q},
+#endif
+#if RIRU_FOR_SDK(29, 30)
+        {nativeSpecializeAppProcess_r_dp3_sig, (void *) nativeSpecializeAppProcess_r_dp3},
+        {nativeSpecializeAppProcess_r_dp2_sig, (void *) nativeSpecializeAppProcess_r_dp2},
+#endif
+        {nullptr, nullptr}
+};
+
+static const method_replacement nativeForkSystemServer_replacements[] = {
+        {nativeForkSystemServer_sig, (void *) nativeForkSystemServer},
+#if RIRU_FOR_SDK(29, 29)
+        {nativeForkSystemServer_samsung_q_sig, (void *) nativeForkSystemServer_samsung_q},
+#endif
+        {nullptr, nullptr}
+};
+
+static void *find_replacement(const method_replacement *replacements, const char *signature, void *original) {
+    for (auto r = replacements; r->signature; ++r) {
+        if (strcmp(r->signature, signature) == 0) return r->fnPtr;
+    }
+    return original;
+}
+
 static JNINativeMethod *onRegisterZygote(
         JNIEnv *env, const char *className, const JNINativeMethod *methods, int numMethods) {
 
@@ -26,89 +148,59 @@ static JNINativeMethod *onRegisterZygote(
         method = methods[i];
 
         if (strcmp(method.name, "nativeForkAndSpecialize") == 0) {
-            JNI::Zygote::nativeForkAndSpecialize = new JNINativeMethod{method.name, method.signature, method.fnPtr};
-
-            if (strcmp(nativeForkAndSpecialize_r_sig, method.signature) == 0)
-                newMethods[i].fnPtr = (void *) nativeForkAndSpecialize_r;
-            else if (strcmp(nativeForkAndSpecialize_p_sig, method.signature) == 0)
-                newMethods[i].fnPtr = (void *) nativeForkAndSpecialize_p;
-            else if (strcmp(nativeForkAndSpecialize_oreo_sig, method.signature) == 0)
-                newMethods[i].fnPtr = (void *) nativeForkAndSpecialize_oreo;
-            else if (strcmp(nativeForkAndSpecialize_marshmallow_sig, method.signature) == 0)
-                newMethods[i].fnPtr = (void *) nativeForkAndSpecialize_marshmallow;
-
-            else if (strcmp(nativeForkAndSpecialize_r_dp3_sig, method.signature) == 0)
-                newMethods[i].fnPtr = (void *) nativeForkAndSpecialize_r_dp3;
-            else if (strcmp(nativeForkAndSpecialize_r_dp2_sig, method.signature) == 0)
-                newMethods[i].fnPtr = (void *) nativeForkAndSpecialize_r_dp2;
-
-            else if (strcmp(nativeForkAndSpecialize_q_alternative_sig, method.signature) == 0)
-                newMethods[i].fnPtr = (void *) nativeForkAndSpecialize_q_alternative;
-
-            else if (strcmp(nativeForkAndSpecialize_samsung_p_sig, method.signature) == 0)
-                newMethods[i].fnPtr = (void *) nativeForkAndSpecialize_samsung_p;
-            else if (strcmp(nativeForkAndSpecialize_samsung_o_sig, method.signature) == 0)
-                newMethods[i].fnPtr = (void *) nativeForkAndSpecialize_samsung_o;
-            else if (strcmp(nativeForkAndSpecialize_samsung_n_sig, method.signature) == 0)
-                newMethods[i].fnPtr = (void *) nativeForkAndSpecialize_samsung_n;
-            else if (strcmp(nativeForkAndSpecialize_samsung_m_sig, method.signature) == 0)
-                newMethods[i].fnPtr = (void *) nativeForkAndSpecialize_samsung_m;
+            JNI::Zygote::nativeForkAndSpecialize = arena::make<JNINativeMethod>(method);
 
-            else
+            newMethods[i].fnPtr = find_replacement(nativeForkAndSpecialize_replacements, method.signature, methods[i].fnPtr);
+            if (newMethods[i].fnPtr == methods[i].fnPtr)
                 LOGW("found nativeForkAndSpecialize but signature %s mismatch", method.signature);
 
             auto replaced = newMethods[i].fnPtr != methods[i].fnPtr;
-            if (replaced) {
-                LOGI("replaced com.android.internal.os.Zygote#nativeForkAndSpecialize");
-                api::setNativeMethodFunc(
-                        get_modules()->at(0)->token, className, newMethods[i].name, newMethods[i].signature, newMethods[i].fnPtr);
-            }
-            status::writeMethodToFile(status::method::forkAndSpecialize, replaced, method.signature);
+            if (replaced) LOGI("replaced com.android.internal.os.Zygote#nativeForkAndSpecialize");
+
+            auto replacement = newMethods[i];
+            after_modules_loaded([=]() {
+                if (replaced) {
+                    api::setNativeMethodFunc(
+                            get_modules()->at(0)->token, JNI::Zygote::classname, replacement.name, replacement.signature, replacement.fnPtr);
+                }
+                status::writeMethodToFile(status::method::forkAndSpecialize, replaced, method.signature);
+            });
         } else if (strcmp(method.name, "nativeSpecializeAppProcess") == 0) {
-            JNI::Zygote::nativeSpecializeAppProcess = new JNINativeMethod{method.name, method.signature, method.fnPtr};
-
-            if (strcmp(nativeSpecializeAppProcess_r_sig, method.signature) == 0)
-                newMethods[i].fnPtr = (void *) nativeSpecializeAppProcess_r;
-            else if (strcmp(nativeSpecializeAppProcess_q_sig, method.signature) == 0)
-                newMethods[i].fnPtr = (void *) nativeSpecializeAppProcess_q;
-            else if (strcmp(nativeSpecializeAppProcess_q_alternative_sig, method.signature) == 0)
-                newMethods[i].fnPtr = (void *) nativeSpecializeAppProcess_q_alternative;
-            else if (strcmp(nativeSpecializeAppProcess_sig_samsung_q, method.signature) == 0)
-                newMethods[i].fnPtr = (void *) nativeSpecializeAppProcess_samsung_q;
-
-            else if (strcmp(nativeSpecializeAppProcess_r_dp3_sig, method.signature) == 0)
-                newMethods[i].fnPtr = (void *) nativeSpecializeAppProcess_r_dp3;
-            else if (strcmp(nativeSpecializeAppProcess_r_dp2_sig, method.signature) == 0)
-                newMethods[i].fnPtr = (void *) nativeSpecializeAppProcess_r_dp2;
+            JNI::Zygote::nativeSpecializeAppProcess = arena::make<JNINativeMethod>(method);
 
-            else
-                LOGW("found nativeSpecializeAppProcess but signature %s mismatch",
-                     method.signature);
+            newMethods[i].fnPtr = find_replacement(nativeSpecializeAppProcess_replacements, method.signature, methods[i].fnPtr);
+            if (newMethods[i].fnPtr == methods[i].fnPtr)
+                LOGW("found nativeSpecializeAppProcess but signature %s mismatch", method.signature);
 
             auto replaced = newMethods[i].fnPtr != methods[i].fnPtr;
-            if (replaced) {
-                LOGI("replaced com.android.internal.os.Zygote#nativeSpecializeAppProcess");
-                api::setNativeMethodFunc(
-                        get_modules()->at(0)->token, className, newMethods[i].name, newMethods[i].signature, newMethods[i].fnPtr);
-            }
-            status::writeMethodToFile(status::method::specializeAppProcess, replaced, method.signature);
+            if (replaced) LOGI("replaced com.android.internal.os.Zygote#nativeSpecializeAppProcess");
+
+            auto replacement = newMethods[i];
+            after_modules_loaded([=]() {
+                if (replaced) {
+                    api::setNativeMethodFunc(
+                            get_modules()->at(0)->token, JNI::Zygote::classname, replacement.name, replacement.signature, replacement.fnPtr);
+                }
+                status::writeMethodToFile(status::method::specializeAppProcess, replaced, method.signature);
+            });
         } else if (strcmp(method.name, "nativeForkSystemServer") == 0) {
-            JNI::Zygote::nativeForkSystemServer = new JNINativeMethod{method.name, method.signature, method.fnPtr};
+            JNI::Zygote::nativeForkSystemServer = arena::make<JNINativeMethod>(method);
 
-            if (strcmp(nativeForkSystemServer_sig, method.signature) == 0)
-                newMethods[i].fnPtr = (void *) nativeForkSystemServer;
-            else if (strcmp(nativeForkSystemServer_samsung_q_sig, method.signature) == 0)
-                newMethods[i].fnPtr = (void *) nativeForkSystemServer_samsung_q;
-            else
+            newMethods[i].fnPtr = find_replacement(nativeForkSystemServer_replacements, method.signature, methods[i].fnPtr);
+            if (newMethods[i].fnPtr == methods[i].fnPtr)
                 LOGW("found nativeForkSystemServer but signature %s mismatch", method.signature);
 
             auto replaced = newMethods[i].fnPtr != methods[i].fnPtr;
-            if (replaced) {
-                LOGI("replaced com.android.internal.os.Zygote#nativeForkSystemServer");
-                api::setNativeMethodFunc(
-                        get_modules()->at(0)->token, className, newMethods[i].name, newMethods[i].signature, newMethods[i].fnPtr);
-            }
-            status::writeMethodToFile(status::method::forkSystemServer, replaced, method.signature);
+            if (replaced) LOGI("replaced com.android.internal.os.Zygote#nativeForkSystemServer");
+
+            auto replacement = newMethods[i];
+            after_modules_loaded([=]() {
+                if (replaced) {
+                    api::setNativeMethodFunc(
+                            get_modules()->at(0)->token, JNI::Zygote::classname, replacement.name, replacement.signature, replacement.fnPtr);
+                }
+                status::writeMethodToFile(status::method::forkSystemServer, replaced, method.signature);
+            });
         }
     }
 
@@ -126,9 +218,9 @@ static JNINativeMethod *onRegisterSystemProperties(
         method = methods[i];
 
         if (strcmp(method.name, "native_set") == 0) {
-            JNI::SystemProperties::set = new JNINativeMethod{method.name, method.signature, method.fnPtr};
+            JNI::SystemProperties::set = arena::make<JNINativeMethod>(method);
 
-            if (strcmp("(Ljava/lang/String;Ljava/lang/String;)V", method.signature) == 0)
+            if (strcmp(predicate::SystemProperties::set.signature, method.signature) == 0)
                 newMethods[i].fnPtr = (void *) SystemProperties_set;
             else
                 LOGW("found native_set but signature %s mismatch", method.signature);
@@ -136,8 +228,11 @@ static JNINativeMethod *onRegisterSystemProperties(
             if (newMethods[i].fnPtr != methods[i].fnPtr) {
                 LOGI("replaced android.os.SystemProperties#native_set");
 
-                api::setNativeMethodFunc(
-                        get_modules()->at(0)->token, className, newMethods[i].name, newMethods[i].signature, newMethods[i].fnPtr);
+                auto replacement = newMethods[i];
+                after_modules_loaded([=]() {
+                    api::setNativeMethodFunc(
+                            get_modules()->at(0)->token, JNI::SystemProperties::classname, replacement.name, replacement.signature, replacement.fnPtr);
+                });
             }
         }
     }
@@ -158,6 +253,9 @@ NEW_FUNC_DEF(int, jniRegisterNativeMethods, JNIEnv *env, const char *className,
 
     LOGD("jniRegisterNativeMethods %s", className);
 
+    // the originals are kept in the arena
+    arena::scope writable;
+
     JNINativeMethod *newMethods = nullptr;
     if (strcmp("com/android/internal/os/Zygote", className) == 0) {
         newMethods = onRegisterZygote(env, className, methods, numMethods);
@@ -188,7 +286,6 @@ void restore_replaced_func(JNIEnv *env) {
 #define restoreMethod(cls, method) \
     if (JNI::cls::method != nullptr) { \
         old_jniRegisterNativeMethods(env, JNI::cls::classname, JNI::cls::method, 1); \
-        delete JNI::cls::method; \
     }
 
     restoreMethod(Zygote, nativeForkAndSpecialize)
@@ -214,7 +311,8 @@ extern "C" void constructor() __attribute__((constructor));
 
 void constructor() {
 #ifdef DEBUG_APP
-    hide::hide_modules(nullptr, 0);
+    maps::snapshot snapshot;
+    hide::hide_modules(snapshot, nullptr, 0, HIDE_MODE_MREMAP);
 #endif
 
     if (getuid() != 0)
@@ -252,6 +350,17 @@ void constructor() {
         LOGE("failed to refresh hook");
     }
 
+    // opt-in: only the hook has to be in place now, the rest overlaps with the preload of zygote
+    // and is joined before its first fork, but modules may then miss what they hook at startup
+    if (access(BACKGROUND_LOAD_FILE, F_OK) == 0) {
+        if (pthread_create(&loader, nullptr, load_in_background, nullptr) == 0) {
+            LOGI("%s exists, load modules in background", BACKGROUND_LOAD_FILE);
+            loading = true;
+            return;
+        }
+        PLOGE("pthread_create");
+    }
+
     load_modules();
 
     status::writeToFile();
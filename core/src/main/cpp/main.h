@@ -3,4 +3,10 @@
 
 void restore_replaced_func(JNIEnv *env);
 
+/**
+ * Join the thread loading the modules if it still runs, finish what waited for it and freeze the
+ * arena. Called on the main thread before anything uses the modules: the pre fork hooks.
+ */
+void wait_for_modules();
+
 #endif // _MAIN_H
@@ -0,0 +1,163 @@
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include "manifest.h"
+#include "logging.h"
+#include "misc.h"
+
+/*
+ * Layout: header, then header.count records of both ABIs, all in native byte order (a device
+ * does not change it). The checksum covers the records.
+ */
+
+namespace manifest {
+
+    static constexpr uint32_t MAGIC = 0x464d5252; // "RRMF"
+    static constexpr uint32_t FORMAT_VERSION = 1;
+    static constexpr uint32_t MAX_RECORDS = 1024;
+
+    static constexpr uint8_t ABI = sizeof(void *) * 8;
+
+    struct header {
+        uint32_t magic;
+        uint32_t version;
+        // a different Riru may accept other API versions
+        uint32_t riru_version;
+        uint32_t count;
+        // of the modules directory when each ABI scanned it, [0] 32-bit, [1] 64-bit
+        int64_t dir_mtime[2];
+        uint32_t checksum;
+        uint32_t reserved;
+    };
+
+    static inline int abi_index(uint8_t abi) {
+        return abi == 64 ? 1 : 0;
+    }
+
+    static uint32_t checksum(const void *data, size_t length) {
+        // FNV-1a
+        uint32_t h = 2166136261u;
+        auto bytes = (const uint8_t *) data;
+        for (size_t i = 0; i < length; ++i) {
+            h = (h ^ bytes[i]) * 16777619u;
+        }
+        return h;
+    }
+
+    static inline int64_t to_ns(const struct timespec &ts) {
+        return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+    }
+
+    bool record::same_file(const struct stat &st) const {
+        return mtime == to_ns(st.st_mtim) && size == (int64_t) st.st_size;
+    }
+
+    void record::set_file(const struct stat &st) {
+        mtime = to_ns(st.st_mtim);
+        size = (int64_t) st.st_size;
+    }
+
+    int64_t mtime_of(const char *path) {
+        struct stat st{};
+        if (stat(path, &st) == -1) return 0;
+        return to_ns(st.st_mtim);
+    }
+
+    /*
+     * Read and check the whole file, records of both ABIs.
+     */
+    static int read_all(const char *path, header &h, std::vector<record> &records) {
+        int fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+            if (errno != ENOENT) PLOGE("open %s", path);
+            return -1;
+        }
+
+        int res = -1;
+        if (read_full(fd, &h, sizeof(h)) == 0 && h.magic == MAGIC && h.version == FORMAT_VERSION
+            && h.riru_version == RIRU_VERSION_CODE && h.count <= MAX_RECORDS) {
+
+            records.resize(h.count);
+            if (read_full(fd, records.data(), sizeof(record) * h.count) == 0
+                && checksum(records.data(), sizeof(record) * h.count) == h.checksum) {
+                res = 0;
+            }
+        }
+        close(fd);
+
+        if (res == -1) {
+            LOGW("%s is invalid", path);
+            records.clear();
+            return -1;
+        }
+        for (auto &r : records) {
+            r.name[sizeof(r.name) - 1] = '\0';
+        }
+        return 0;
+    }
+
+    int read(const char *path, int64_t dir_mtime, std::vector<record> &records) {
+        header h{};
+        std::vector<record> all;
+        if (read_all(path, h, all) == -1) return -1;
+
+        if (dir_mtime == 0 || h.dir_mtime[abi_index(ABI)] != dir_mtime) {
+            LOGD("%s is stale", path);
+            return -1;
+        }
+
+        records.clear();
+        for (auto &r : all) {
+            if (r.abi == ABI) records.push_back(r);
+        }
+        return 0;
+    }
+
+    int write(const char *path, int64_t dir_mtime, const std::vector<record> &records) {
+        header h{};
+        std::vector<record> all;
+        if (read_all(path, h, all) == -1) {
+            h = {};
+            all.clear();
+        }
+
+        std::vector<record> merged;
+        for (auto &r : all) {
+            if (r.abi != ABI) merged.push_back(r);
+        }
+        for (auto r : records) {
+            r.abi = ABI;
+            merged.push_back(r);
+        }
+        if (merged.size() > MAX_RECORDS) return -1;
+
+        h.magic = MAGIC;
+        h.version = FORMAT_VERSION;
+        h.riru_version = RIRU_VERSION_CODE;
+        h.count = (uint32_t) merged.size();
+        h.dir_mtime[abi_index(ABI)] = dir_mtime;
+        h.checksum = checksum(merged.data(), sizeof(record) * merged.size());
+
+        // zygote32 and zygote64 may write at once, each one renames a complete file
+        char tmp[PATH_MAX];
+        snprintf(tmp, sizeof(tmp), "%s.%d", path, ABI);
+        int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+        if (fd == -1) {
+            PLOGE("open %s", tmp);
+            return -1;
+        }
+        int res = write_full(fd, &h, sizeof(h));
+        if (res == 0) res = write_full(fd, merged.data(), sizeof(record) * merged.size());
+        close(fd);
+
+        if (res != 0 || rename(tmp, path) == -1) {
+            PLOGE("write %s", path);
+            unlink(tmp);
+            return -1;
+        }
+        return 0;
+    }
+}
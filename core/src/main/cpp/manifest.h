@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <sys/stat.h>
+
+namespace manifest {
+
+    enum state : uint8_t {
+        // no library for this ABI
+        STATE_MISSING,
+        STATE_LOADED,
+        // dlopen or the init handshake failed
+        STATE_FAILED,
+        // has a targets file, not loaded in zygote
+        STATE_ON_DEMAND
+    };
+
+    /**
+     * What the last boot learned about a module directory, for one ABI.
+     */
+    struct record {
+        char name[128];
+        uint8_t abi;
+        uint8_t state;
+        // accepted API version of a loaded module
+        uint16_t api;
+        uint32_t reserved;
+        // of the library, 0 if missing
+        int64_t mtime;
+        int64_t size;
+
+        bool same_file(const struct stat &st) const;
+
+        void set_file(const struct stat &st);
+    };
+
+    /**
+     * Modification time of path in nanoseconds, 0 if it cannot be stat.
+     */
+    int64_t mtime_of(const char *path);
+
+    /**
+     * Read the records of the current ABI from the manifest shared by both zygotes.
+     * @return 0 if the manifest is valid and the modules directory is as this ABI last scanned
+     * it (dir_mtime), -1 otherwise (missing, corrupt, other Riru version, stale)
+     */
+    int read(const char *path, int64_t dir_mtime, std::vector<record> &records);
+
+    /**
+     * Replace the records of the current ABI, those of the other ABI are kept from the file
+     * as it is now. Written to a temporary file renamed over path.
+     * @return 0 on success, -1 on error
+     */
+    int write(const char *path, int64_t dir_mtime, const std::vector<record> &records);
+}
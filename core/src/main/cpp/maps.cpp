@@ -0,0 +1,319 @@
+#include <cerrno>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "maps.h"
+
+namespace maps {
+
+    static inline int hex_value(char c) {
+        if (c >= '0' && c <= '9') return c - '0';
+        if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+        return -1;
+    }
+
+    static const char *parse_hex(const char *p, const char *end, uint64_t *out) {
+        const char *begin = p;
+        uint64_t value = 0;
+        int digit;
+        while (p < end && (digit = hex_value(*p)) != -1) {
+            value = (value << 4u) | (uint64_t) digit;
+            ++p;
+        }
+        if (p == begin) return nullptr;
+        *out = value;
+        return p;
+    }
+
+    static const char *parse_dec(const char *p, const char *end, uint64_t *out) {
+        const char *begin = p;
+        uint64_t value = 0;
+        while (p < end && *p >= '0' && *p <= '9') {
+            value = value * 10 + (uint64_t) (*p - '0');
+            ++p;
+        }
+        if (p == begin) return nullptr;
+        *out = value;
+        return p;
+    }
+
+    static inline const char *expect(const char *p, const char *end, char c) {
+        if (p == nullptr || p >= end || *p != c) return nullptr;
+        return p + 1;
+    }
+
+#define DELETED_MARK " (deleted)"
+
+    /*
+     * 7f8e4c2000-7f8e4c4000 r-xp 00002000 fd:01 1234    /system/lib64/libfoo.so
+     */
+    static bool parse_line(const char *p, const char *end, mapping *m) {
+        uint64_t value;
+
+        if (!(p = expect(parse_hex(p, end, &value), end, '-'))) return false;
+        m->start = (uintptr_t) value;
+        if (!(p = expect(parse_hex(p, end, &value), end, ' '))) return false;
+        m->end = (uintptr_t) value;
+
+        if (end - p < 5 || p[4] != ' ') return false;
+        m->perms = (p[0] == 'r' ? PERM_R : 0)
+                   | (p[1] == 'w' ? PERM_W : 0)
+                   | (p[2] == 'x' ? PERM_X : 0)
+                   | (p[3] == 'p' ? PERM_P : 0);
+        p += 5;
+
+        if (!(p = expect(parse_hex(p, end, &m->offset), end, ' '))) return false;
+        if (!(p = expect(parse_hex(p, end, &value), end, ':'))) return false;
+        m->dev_major = (unsigned int) value;
+        if (!(p = parse_hex(p, end, &value))) return false;
+        m->dev_minor = (unsigned int) value;
+        if (!(p = expect(p, end, ' '))) return false;
+        if (!(p = parse_dec(p, end, &m->inode))) return false;
+
+        while (p < end && *p == ' ') ++p;
+
+        m->path.data = p;
+        m->path.length = (size_t) (end - p);
+        m->deleted = m->path.ends_with(DELETED_MARK, sizeof(DELETED_MARK) - 1);
+        if (m->deleted) m->path.length -= sizeof(DELETED_MARK) - 1;
+        return true;
+    }
+
+    bool string_ref::contains(const char *str) const {
+        size_t str_length = strlen(str);
+        if (str_length == 0) return true;
+        if (str_length > length) return false;
+
+        const char *p = data, *last = data + length - str_length;
+        while (p <= last) {
+            p = (const char *) memchr(p, str[0], (size_t) (last - p) + 1);
+            if (p == nullptr) return false;
+            if (memcmp(p, str, str_length) == 0) return true;
+            ++p;
+        }
+        return false;
+    }
+
+    int to_prot(int perms) {
+        int prot = 0;
+        if (perms & PERM_R) prot |= PROT_READ;
+        if (perms & PERM_W) prot |= PROT_WRITE;
+        if (perms & PERM_X) prot |= PROT_EXEC;
+        return prot;
+    }
+
+    int mapping::prot() const {
+        return to_prot(perms);
+    }
+
+    void mapping::perm_string(char buf[5]) const {
+        buf[0] = perms & PERM_R ? 'r' : '-';
+        buf[1] = perms & PERM_W ? 'w' : '-';
+        buf[2] = perms & PERM_X ? 'x' : '-';
+        buf[3] = perms & PERM_P ? 'p' : 's';
+        buf[4] = '\0';
+    }
+
+    /*
+     * Call handler(begin, end) with runs of complete lines, only the last line of the file may
+     * lack '\n'. Returns 1 if the handler stopped the iteration.
+     */
+    template<typename F>
+    static int read_lines(int fd, F handler) {
+        char buf[BUFFER_SIZE];
+        size_t size = 0;
+        // a line longer than the buffer is dropped until its end
+        bool discard = false;
+
+        while (true) {
+            ssize_t count = read(fd, buf + size, BUFFER_SIZE - size);
+            if (count == -1) {
+                if (errno == EINTR) continue;
+                return -1;
+            }
+            if (count == 0) break;
+
+            char *begin = buf, *end = buf + size + count;
+            if (discard) {
+                auto eol = (char *) memchr(begin, '\n', (size_t) (end - begin));
+                if (eol == nullptr) {
+                    size = 0;
+                    continue;
+                }
+                discard = false;
+                begin = eol + 1;
+            }
+
+            auto last = (char *) memrchr(begin, '\n', (size_t) (end - begin));
+            if (last != nullptr) {
+                if (!handler(begin, last + 1)) return 1;
+                begin = last + 1;
+            }
+
+            size = (size_t) (end - begin);
+            if (size == BUFFER_SIZE) {
+                discard = true;
+                size = 0;
+            } else if (size > 0 && begin != buf) {
+                memmove(buf, begin, size);
+            }
+        }
+
+        if (size > 0 && !discard && !handler(buf, buf + size)) return 1;
+        return 0;
+    }
+
+    static inline const char *line_end(const char *p, const char *end) {
+        auto eol = (const char *) memchr(p, '\n', (size_t) (end - p));
+        return eol ? eol : end;
+    }
+
+    int for_each_fd(int fd, callback_t *callback, void *data) {
+        mapping m{};
+        int res = read_lines(fd, [&](const char *p, const char *end) -> bool {
+            while (p < end) {
+                auto eol = line_end(p, end);
+                if (parse_line(p, eol, &m) && !callback(&m, data)) return false;
+                p = eol + 1;
+            }
+            return true;
+        });
+        return res == -1 ? -1 : 0;
+    }
+
+    bool filter::matches(const string_ref &path) const {
+        for (size_t i = 0; i < count; ++i) {
+            auto pattern = patterns[i];
+            switch (type) {
+                case FILTER_EXACT:
+                    if (path.equals(pattern)) return true;
+                    break;
+                case FILTER_SUFFIX:
+                    if (path.ends_with(pattern)) return true;
+                    break;
+                case FILTER_CONTAINS:
+                    if (path.contains(pattern)) return true;
+                    break;
+            }
+        }
+        return false;
+    }
+
+    /*
+     * Bytes seen on every line of a maps file (addresses, perms, dev, inode, slashes),
+     * memchr on one of them would stop everywhere.
+     */
+    static bool is_common_byte(char c) {
+        return hex_value(c) != -1 || strchr("-: \nrwxps/[]", c) != nullptr;
+    }
+
+    int query_fd(int fd, const filter &filter, callback_t *callback, void *data) {
+        if (filter.count == 0) return 0;
+
+        // every match contains the longest common prefix of the patterns, search it with memchr
+        // on a byte unlikely to be elsewhere and only parse the lines where it appears
+        const char *needle = filter.patterns[0];
+        size_t needle_length = strlen(needle);
+        for (size_t i = 1; i < filter.count; ++i) {
+            size_t n = 0;
+            while (n < needle_length && filter.patterns[i][n] == needle[n]) ++n;
+            needle_length = n;
+        }
+
+        if (needle_length == 0) {
+            struct args_t {
+                const maps::filter *filter;
+                callback_t *callback;
+                void *data;
+            } args{&filter, callback, data};
+
+            return for_each_fd(fd, [](const mapping *mapping, void *data) -> bool {
+                auto args = (args_t *) data;
+                if (!args->filter->matches(mapping->path)) return true;
+                return args->callback(mapping, args->data);
+            }, &args);
+        }
+
+        size_t anchor = needle_length - 1;
+        // if the needle has a byte which never appears before the path, the first hit of a line is
+        // inside the path and the rest of the line can be checked before parsing it
+        bool in_path = false;
+        for (size_t i = needle_length; i > 0; --i) {
+            // names of libraries are more distinctive than the directories before them
+            if (!is_common_byte(needle[i - 1])) {
+                anchor = i - 1;
+                in_path = true;
+                break;
+            }
+        }
+
+        mapping m{};
+        int res = read_lines(fd, [&](const char *begin, const char *end) -> bool {
+            const char *p = begin;
+            while (p < end && (size_t) (end - p) >= needle_length) {
+                auto hit = (const char *) memchr(p + anchor, needle[anchor], (size_t) (end - p) - needle_length + 1);
+                if (hit == nullptr) break;
+
+                auto candidate = hit - anchor;
+                if (memcmp(candidate, needle, needle_length) != 0) {
+                    p = candidate + 1;
+                    continue;
+                }
+
+                auto eol = line_end(candidate, end);
+                if (in_path) {
+                    string_ref tail{candidate, (size_t) (eol - candidate)};
+                    if (tail.ends_with(DELETED_MARK, sizeof(DELETED_MARK) - 1)) {
+                        tail.length -= sizeof(DELETED_MARK) - 1;
+                    }
+                    if (!filter.matches(tail)) {
+                        p = eol + 1;
+                        continue;
+                    }
+                }
+
+                auto bol = (const char *) memrchr(begin, '\n', (size_t) (candidate - begin));
+                bol = bol ? bol + 1 : begin;
+
+                if (parse_line(bol, eol, &m) && filter.matches(m.path) && !callback(&m, data)) return false;
+                p = eol + 1;
+            }
+            return true;
+        });
+        return res == -1 ? -1 : 0;
+    }
+
+    static int open_maps(pid_t pid) {
+        char path[32];
+        if (pid >= 0) {
+            snprintf(path, sizeof(path), "/proc/%d/maps", pid);
+        } else {
+            snprintf(path, sizeof(path), "/proc/self/maps");
+        }
+        return open(path, O_RDONLY | O_CLOEXEC);
+    }
+
+    int for_each(pid_t pid, callback_t *callback, void *data) {
+        int fd = open_maps(pid);
+        if (fd == -1) return -1;
+
+        int res = for_each_fd(fd, callback, data);
+        int saved_errno = errno;
+        close(fd);
+        errno = saved_errno;
+        return res;
+    }
+
+    int query(pid_t pid, const filter &filter, callback_t *callback, void *data) {
+        int fd = open_maps(pid);
+        if (fd == -1) return -1;
+
+        int res = query_fd(fd, filter, callback, data);
+        int saved_errno = errno;
+        close(fd);
+        errno = saved_errno;
+        return res;
+    }
+}
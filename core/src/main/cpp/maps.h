@@ -0,0 +1,148 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <sys/types.h>
+
+/**
+ * Streaming parser of /proc/<pid>/maps.
+ *
+ * The file is read in large chunks into one stack buffer and every line is decoded in place,
+ * nothing is allocated. The mapping passed to the callback (including its path) is only
+ * valid during the call.
+ */
+namespace maps {
+
+    constexpr size_t BUFFER_SIZE = 32 * 1024;
+
+    enum perm {
+        PERM_R = 1 << 0,
+        PERM_W = 1 << 1,
+        PERM_X = 1 << 2,
+        PERM_P = 1 << 3
+    };
+
+    /**
+     * PERM_R/W/X to PROT_READ/WRITE/EXEC.
+     */
+    int to_prot(int perms);
+
+    struct string_ref {
+        const char *data;
+        size_t length;
+
+        bool empty() const {
+            return length == 0;
+        }
+
+        bool equals(const char *str, size_t str_length) const {
+            return length == str_length && memcmp(data, str, length) == 0;
+        }
+
+        bool equals(const char *str) const {
+            return equals(str, strlen(str));
+        }
+
+        bool ends_with(const char *str, size_t str_length) const {
+            return length >= str_length && memcmp(data + length - str_length, str, str_length) == 0;
+        }
+
+        bool ends_with(const char *str) const {
+            return ends_with(str, strlen(str));
+        }
+
+        bool contains(const char *str) const;
+    };
+
+    struct mapping {
+        uintptr_t start;
+        uintptr_t end;
+        int perms;
+        uint64_t offset;
+        unsigned int dev_major;
+        unsigned int dev_minor;
+        uint64_t inode;
+        // the " (deleted)" mark is stripped from path
+        bool deleted;
+        string_ref path;
+
+        int prot() const;
+
+        // "rwxp" and a terminating zero
+        void perm_string(char buf[5]) const;
+    };
+
+    enum filter_type {
+        FILTER_EXACT,
+        FILTER_SUFFIX,
+        FILTER_CONTAINS
+    };
+
+    /**
+     * Path predicate pushed down into the scanner, a mapping matches if its path
+     * (without " (deleted)") equals, ends with or contains any of the patterns.
+     */
+    struct filter {
+        filter_type type;
+        const char *const *patterns;
+        size_t count;
+
+        bool matches(const string_ref &path) const;
+    };
+
+    /**
+     * Return false to stop the iteration.
+     */
+    using callback_t = bool(const mapping *mapping, void *data);
+
+    /**
+     * Parse a maps file already opened, fd is not closed.
+     * @return 0 on success, -1 on read error
+     */
+    int for_each_fd(int fd, callback_t *callback, void *data);
+
+    /**
+     * @param pid the process id whose memory map to be parsed, the current process if pid < 0
+     * @return 0 on success, -1 on error (errno is set)
+     */
+    int for_each(pid_t pid, callback_t *callback, void *data);
+
+    /**
+     * Like for_each_fd, but only lines whose path matches the filter are parsed.
+     *
+     * Candidate lines are found with memchr over the whole buffer, for the common case of
+     * looking for a few library names this costs about as much as a memory scan.
+     */
+    int query_fd(int fd, const filter &filter, callback_t *callback, void *data);
+
+    int query(pid_t pid, const filter &filter, callback_t *callback, void *data);
+
+    template<typename F>
+    inline int for_each(pid_t pid, F f) {
+        return for_each(pid, [](const mapping *mapping, void *data) -> bool {
+            return (*(F *) data)(*mapping);
+        }, &f);
+    }
+
+    template<typename F>
+    inline int for_each_fd(int fd, F f) {
+        return for_each_fd(fd, [](const mapping *mapping, void *data) -> bool {
+            return (*(F *) data)(*mapping);
+        }, &f);
+    }
+
+    template<typename F>
+    inline int query(pid_t pid, const filter &filter, F f) {
+        return query(pid, filter, [](const mapping *mapping, void *data) -> bool {
+            return (*(F *) data)(*mapping);
+        }, &f);
+    }
+
+    template<typename F>
+    inline int query_fd(int fd, const filter &filter, F f) {
+        return query_fd(fd, filter, [](const mapping *mapping, void *data) -> bool {
+            return (*(F *) data)(*mapping);
+        }, &f);
+    }
+}
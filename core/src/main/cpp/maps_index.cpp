@@ -0,0 +1,96 @@
+#include <mutex>
+#include <string>
+#include <unordered_set>
+#include "maps_index.h"
+
+namespace maps {
+
+    static const char *intern(const char *path) {
+        static auto *paths = new std::unordered_set<std::string>();
+        static std::mutex mutex;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        // elements of an unordered_set never move
+        return paths->insert(path).first->c_str();
+    }
+
+    interval_index::interval_index(const snapshot &snapshot) {
+        std::vector<const char *> paths(snapshot.path_count(), "");
+        for (uint32_t id = 1; id < paths.size(); ++id) {
+            paths[id] = intern(snapshot.path(id));
+        }
+
+        auto n = snapshot.size();
+        entries_.reserve(n);
+        for (size_t i = 0; i < n; ++i) {
+            entries_.push_back({snapshot.start(i), snapshot.end(i), snapshot.offset(i), snapshot.perms(i),
+                                paths[snapshot.path_id(i)]});
+        }
+
+        starts_.resize(n + 1);
+        order_.resize(n + 1);
+        layout(0, 1);
+    }
+
+    /*
+     * In-order walk of the implicit tree, slot k has children 2k and 2k + 1.
+     */
+    size_t interval_index::layout(size_t i, size_t k) {
+        if (k < starts_.size()) {
+            i = layout(i, 2 * k);
+            starts_[k] = entries_[i].start;
+            order_[k] = (uint32_t) i;
+            i = layout(i + 1, 2 * k + 1);
+        }
+        return i;
+    }
+
+    /*
+     * Index of the last entry starting at or before address, size() if there is none.
+     */
+    size_t interval_index::find_index(uintptr_t address) const {
+        size_t n = entries_.size();
+        size_t k = 1;
+        while (k <= n) {
+            k = 2 * k + (starts_[k] <= address);
+        }
+        // drop the right turns taken after the last left turn, k is the first start > address
+        k >>= __builtin_ffsl((long) ~k);
+
+        size_t upper = k == 0 ? n : order_[k];
+        return upper == 0 ? n : upper - 1;
+    }
+
+    const interval_index::entry *interval_index::find(uintptr_t address) const {
+        auto i = find_index(address);
+        if (i == entries_.size() || address >= entries_[i].end) return nullptr;
+        return &entries_[i];
+    }
+
+    size_t interval_index::find(const uintptr_t *addresses, const entry **results, size_t count) const {
+        size_t found = 0;
+        size_t last = entries_.size();
+
+        for (size_t j = 0; j < count; ++j) {
+            auto address = addresses[j];
+            size_t i;
+            if (last < entries_.size() && address >= entries_[last].start && address < entries_[last].end) {
+                i = last;
+            } else if (last + 1 < entries_.size() && address >= entries_[last + 1].start
+                       && address < entries_[last + 1].end) {
+                i = last + 1;
+            } else {
+                i = find_index(address);
+            }
+
+            if (i < entries_.size() && address >= entries_[i].start && address < entries_[i].end) {
+                results[j] = &entries_[i];
+                last = i;
+                found += 1;
+            } else {
+                results[j] = nullptr;
+            }
+        }
+        return found;
+    }
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <vector>
+#include "maps_snapshot.h"
+
+namespace maps {
+
+    /**
+     * Immutable address -> mapping index built from a snapshot.
+     *
+     * Starts are kept in Eytzinger (BFS) order so the binary search walks the array front to
+     * back and the first levels share cache lines. Building is a copy plus one in-order walk,
+     * so a new index is simply built whenever the snapshot changes.
+     */
+    class interval_index {
+
+    public:
+        struct entry {
+            uintptr_t start;
+            uintptr_t end;
+            uint64_t offset;
+            int perms;
+            // interned for the process lifetime, stays valid after the index is rebuilt
+            const char *path;
+        };
+
+        explicit interval_index(const snapshot &snapshot);
+
+        size_t size() const {
+            return entries_.size();
+        }
+
+        /**
+         * @return the mapping containing address, null if there is none
+         */
+        const entry *find(uintptr_t address) const;
+
+        /**
+         * Look up count addresses, results[i] is null if addresses[i] is not mapped.
+         * Sorted or clustered addresses are cheaper, neighbours of the last hit are tried first.
+         * @return number of addresses found
+         */
+        size_t find(const uintptr_t *addresses, const entry **results, size_t count) const;
+
+    private:
+        std::vector<entry> entries_;
+        // 1-based Eytzinger layout of entry starts and the sorted index of each slot
+        std::vector<uintptr_t> starts_;
+        std::vector<uint32_t> order_;
+
+        size_t layout(size_t i, size_t k);
+
+        size_t find_index(uintptr_t address) const;
+    };
+}
@@ -0,0 +1,239 @@
+#include <algorithm>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "maps_snapshot.h"
+
+namespace maps {
+
+    static uint32_t hash(const char *data, size_t length) {
+        // FNV-1a
+        uint32_t h = 2166136261u;
+        for (size_t i = 0; i < length; ++i) {
+            h = (h ^ (uint8_t) data[i]) * 16777619u;
+        }
+        return h;
+    }
+
+    void snapshot::clear() {
+        starts_.clear();
+        ends_.clear();
+        offsets_.clear();
+        perms_.clear();
+        path_ids_.clear();
+        arena_.clear();
+        path_offsets_.clear();
+        table_.clear();
+        stale_.clear();
+
+        // id 0, the empty path
+        arena_.push_back('\0');
+        path_offsets_.push_back(0);
+    }
+
+    void snapshot::rehash(size_t capacity) {
+        table_.assign(capacity, 0);
+        size_t mask = capacity - 1;
+        for (uint32_t id = 1; id < path_offsets_.size(); ++id) {
+            auto p = path(id);
+            size_t slot = hash(p, strlen(p)) & mask;
+            while (table_[slot] != 0) slot = (slot + 1) & mask;
+            table_[slot] = id + 1;
+        }
+    }
+
+    uint32_t snapshot::intern(const string_ref &path) {
+        if (path.empty()) return NO_PATH;
+
+        // keep the load factor under 1/2
+        if (path_offsets_.size() * 2 >= table_.size()) {
+            rehash(table_.empty() ? 64 : table_.size() * 2);
+        }
+
+        size_t mask = table_.size() - 1;
+        size_t slot = hash(path.data, path.length) & mask;
+        while (table_[slot] != 0) {
+            uint32_t id = table_[slot] - 1;
+            auto p = this->path(id);
+            if (strncmp(p, path.data, path.length) == 0 && p[path.length] == '\0') return id;
+            slot = (slot + 1) & mask;
+        }
+
+        auto id = (uint32_t) path_offsets_.size();
+        path_offsets_.push_back((uint32_t) arena_.size());
+        arena_.insert(arena_.end(), path.data, path.data + path.length);
+        arena_.push_back('\0');
+        table_[slot] = id + 1;
+        return id;
+    }
+
+    uint32_t snapshot::find_path(const char *path) const {
+        if (table_.empty() || !path || !*path) return NO_PATH;
+
+        size_t length = strlen(path);
+        size_t mask = table_.size() - 1;
+        size_t slot = hash(path, length) & mask;
+        while (table_[slot] != 0) {
+            uint32_t id = table_[slot] - 1;
+            if (strcmp(this->path(id), path) == 0) return id;
+            slot = (slot + 1) & mask;
+        }
+        return NO_PATH;
+    }
+
+    void snapshot::add(const mapping &mapping) {
+        starts_.push_back(mapping.start);
+        ends_.push_back(mapping.end);
+        offsets_.push_back(mapping.offset);
+        perms_.push_back((uint8_t) mapping.perms);
+        path_ids_.push_back(intern(mapping.path));
+    }
+
+    int snapshot::take(pid_t pid) {
+        clear();
+
+        auto res = for_each(pid, [this](const mapping &mapping) -> bool {
+            add(mapping);
+            return true;
+        });
+
+        taken_ = res == 0;
+        return res;
+    }
+
+    int snapshot::take_fd(int fd) {
+        clear();
+
+        auto res = for_each_fd(fd, [this](const mapping &mapping) -> bool {
+            add(mapping);
+            return true;
+        });
+
+        taken_ = res == 0;
+        return res;
+    }
+
+    void snapshot::insert(size_t index, uintptr_t start, uintptr_t end, uint64_t offset, int perms, uint32_t path_id) {
+        starts_.insert(starts_.begin() + index, start);
+        ends_.insert(ends_.begin() + index, end);
+        offsets_.insert(offsets_.begin() + index, offset);
+        perms_.insert(perms_.begin() + index, (uint8_t) perms);
+        path_ids_.insert(path_ids_.begin() + index, path_id);
+    }
+
+    void snapshot::erase(size_t index) {
+        starts_.erase(starts_.begin() + index);
+        ends_.erase(ends_.begin() + index);
+        offsets_.erase(offsets_.begin() + index);
+        perms_.erase(perms_.begin() + index);
+        path_ids_.erase(path_ids_.begin() + index);
+    }
+
+    /*
+     * Cut [start, end) out of all mappings, splitting the ones crossing its bounds.
+     * Returns the index where a mapping of [start, end) belongs.
+     */
+    size_t snapshot::carve(uintptr_t start, uintptr_t end) {
+        // mappings do not overlap, so ends are sorted as well
+        auto i = (size_t) (std::upper_bound(ends_.begin(), ends_.end(), start) - ends_.begin());
+
+        while (i < starts_.size() && starts_[i] < end) {
+            auto s = starts_[i], e = ends_[i];
+            if (s < start && e > end) {
+                insert(i + 1, end, e, offsets_[i] + (end - s), perms_[i], path_ids_[i]);
+                ends_[i] = start;
+                return i + 1;
+            }
+            if (s < start) {
+                ends_[i] = start;
+                ++i;
+            } else if (e > end) {
+                offsets_[i] += end - s;
+                starts_[i] = end;
+                break;
+            } else {
+                erase(i);
+            }
+        }
+        return i;
+    }
+
+    void snapshot::mapped(uintptr_t start, uintptr_t end, int prot, uint32_t path_id) {
+        if (!taken_ || start >= end) return;
+
+        int perms = PERM_P;
+        if (prot & PROT_READ) perms |= PERM_R;
+        if (prot & PROT_WRITE) perms |= PERM_W;
+        if (prot & PROT_EXEC) perms |= PERM_X;
+
+        auto i = carve(start, end);
+        insert(i, start, end, 0, perms, path_id);
+    }
+
+    void snapshot::unmapped(uintptr_t start, uintptr_t end) {
+        if (!taken_ || start >= end) return;
+
+        carve(start, end);
+    }
+
+    void snapshot::invalidate(uintptr_t start, uintptr_t end) {
+        if (!taken_ || start >= end) return;
+
+        stale_.push_back(start);
+        stale_.push_back(end);
+    }
+
+    enum probe_result {
+        PROBE_MAPPED,
+        PROBE_UNMAPPED,
+        PROBE_UNKNOWN
+    };
+
+    /*
+     * mincore fails with ENOMEM if any page of the range is not mapped, an mmap hint is only
+     * honored if the whole range is free. Neither needs /proc.
+     */
+    static probe_result probe(uintptr_t start, uintptr_t end) {
+        static const auto page_size = (uintptr_t) sysconf(_SC_PAGESIZE);
+        unsigned char vec[256];
+
+        bool mapped = true;
+        for (auto p = start; p < end; p += page_size * sizeof(vec)) {
+            auto length = std::min(end - p, page_size * sizeof(vec));
+            if (mincore((void *) p, length, vec) == -1) {
+                if (errno != ENOMEM) return PROBE_UNKNOWN;
+                mapped = false;
+                break;
+            }
+        }
+        if (mapped) return PROBE_MAPPED;
+
+        auto addr = mmap((void *) start, end - start, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (addr == MAP_FAILED) return PROBE_UNKNOWN;
+        munmap(addr, end - start);
+        return (uintptr_t) addr == start ? PROBE_UNMAPPED : PROBE_UNKNOWN;
+    }
+
+    int snapshot::validate() {
+        for (size_t k = 0; k < stale_.size(); k += 2) {
+            auto start = stale_[k], end = stale_[k + 1];
+            auto i = (size_t) (std::upper_bound(ends_.begin(), ends_.end(), start) - ends_.begin());
+
+            while (i < starts_.size() && starts_[i] < end) {
+                auto s = std::max(start, starts_[i]), e = std::min(end, ends_[i]);
+                switch (probe(s, e)) {
+                    case PROBE_MAPPED:
+                        ++i;
+                        break;
+                    case PROBE_UNMAPPED:
+                        i = carve(s, e);
+                        break;
+                    default:
+                        return take();
+                }
+            }
+        }
+        stale_.clear();
+        return 0;
+    }
+}
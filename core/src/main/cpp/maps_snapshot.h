@@ -0,0 +1,143 @@
+#pragma once
+
+#include <vector>
+#include "maps.h"
+
+namespace maps {
+
+    /**
+     * Compact copy of /proc/self/maps kept in struct-of-arrays form, paths are interned into
+     * one string arena and referenced by id (0 is the empty path of anonymous mappings).
+     *
+     * It is read once and then kept in sync by the code which changes the memory map:
+     * mapped()/unmapped() for changes made by core itself, invalidate() for changes made by
+     * someone else (e.g. the linker in dlclose) which are resolved lazily by validate().
+     */
+    class snapshot {
+
+    public:
+        static constexpr uint32_t NO_PATH = 0;
+
+        /**
+         * Read the memory map of pid (the current process if pid < 0), replacing the content.
+         * @return 0 on success, -1 on error
+         */
+        int take(pid_t pid = -1);
+
+        /**
+         * Like take, from a maps file already opened, fd is not closed.
+         */
+        int take_fd(int fd);
+
+        /**
+         * Take the snapshot if it was never taken.
+         */
+        int ensure() {
+            return taken_ ? 0 : take();
+        }
+
+        bool taken() const {
+            return taken_;
+        }
+
+        size_t size() const {
+            return starts_.size();
+        }
+
+        uintptr_t start(size_t i) const {
+            return starts_[i];
+        }
+
+        uintptr_t end(size_t i) const {
+            return ends_[i];
+        }
+
+        uint64_t offset(size_t i) const {
+            return offsets_[i];
+        }
+
+        int perms(size_t i) const {
+            return perms_[i];
+        }
+
+        int prot(size_t i) const {
+            return to_prot(perms_[i]);
+        }
+
+        uint32_t path_id(size_t i) const {
+            return path_ids_[i];
+        }
+
+        size_t path_count() const {
+            return path_offsets_.size();
+        }
+
+        const char *path(uint32_t id) const {
+            return &arena_[path_offsets_[id]];
+        }
+
+        /**
+         * @return id of path, NO_PATH if no mapping has this path
+         */
+        uint32_t find_path(const char *path) const;
+
+        template<typename F>
+        void for_each_of_path(uint32_t id, F f) const {
+            for (size_t i = 0; i < path_ids_.size(); ++i) {
+                if (path_ids_[i] == id) f(i);
+            }
+        }
+
+        /**
+         * Core mapped [start, end) itself.
+         */
+        void mapped(uintptr_t start, uintptr_t end, int prot, uint32_t path_id = NO_PATH);
+
+        /**
+         * Core unmapped [start, end) itself.
+         */
+        void unmapped(uintptr_t start, uintptr_t end);
+
+        /**
+         * [start, end) may have been changed by someone else.
+         */
+        void invalidate(uintptr_t start, uintptr_t end);
+
+        /**
+         * Resolve invalidated ranges: mappings still fully present are kept, mappings fully
+         * gone are dropped, anything else makes the whole snapshot to be read again.
+         * @return 0 on success, -1 on error
+         */
+        int validate();
+
+    private:
+        bool taken_ = false;
+
+        std::vector<uintptr_t> starts_;
+        std::vector<uintptr_t> ends_;
+        std::vector<uint64_t> offsets_;
+        std::vector<uint8_t> perms_;
+        std::vector<uint32_t> path_ids_;
+
+        std::vector<char> arena_;
+        std::vector<uint32_t> path_offsets_;
+        // open addressing, path id + 1 of each slot, 0 is empty
+        std::vector<uint32_t> table_;
+
+        std::vector<uintptr_t> stale_;
+
+        void clear();
+
+        void add(const mapping &mapping);
+
+        uint32_t intern(const string_ref &path);
+
+        void rehash(size_t capacity);
+
+        size_t carve(uintptr_t start, uintptr_t end);
+
+        void insert(size_t index, uintptr_t start, uintptr_t end, uint64_t offset, int perms, uint32_t path_id);
+
+        void erase(size_t index);
+    };
+}
@@ -1,7 +1,11 @@
 #include <dirent.h>
 #include <unistd.h>
 #include <dlfcn.h>
+#include <link.h>
+#include <cerrno>
+#include <cinttypes>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include "module.h"
 #include "wrap.h"
 #include "logging.h"
@@ -9,14 +13,26 @@
 #include "config.h"
 #include "status.h"
 #include "hide_utils.h"
+#include "maps_snapshot.h"
+#include "manifest.h"
+#include "init_pool.h"
+#include "jni_predicate.h"
 
-std::vector<RiruModule *> *get_modules() {
-    static auto *modules = new std::vector<RiruModule *>({new RiruModule(strdup(MODULE_NAME_CORE))});
+module_list *get_modules() {
+    static auto *modules = arena::make<module_list>(1, arena::make<RiruModule>(arena::strdup(MODULE_NAME_CORE)));
     return modules;
 }
 
+on_demand_module_list *get_on_demand_modules() {
+    static auto *modules = arena::make<on_demand_module_list>();
+    return modules;
+}
+
+// read in zygote, forked processes cannot read CONFIG_DIR
+static hide_mode on_demand_hide_mode = HIDE_MODE_MREMAP;
+
 static RiruModuleInfoV9 *init_module_v9(uint32_t token, RiruInit_t *init) {
-    auto riru = new RiruApiV9();
+    auto riru = arena::make<RiruApiV9>();
     riru->token = token;
     riru->getFunc = api::getFunc;
     riru->setFunc = api::setFunc;
@@ -29,39 +45,137 @@ static RiruModuleInfoV9 *init_module_v9(uint32_t token, RiruInit_t *init) {
     return (RiruModuleInfoV9 *) init(riru);
 }
 
-static void cleanup(void *handle, const char *path) {
+static RiruModuleInfoV10 *init_module_v10(uint32_t token, RiruInit_t *init) {
+    auto riru = arena::make<RiruApiV10>();
+    riru->token = token;
+    riru->getFunc = api::getFunc;
+    riru->setFunc = api::setFunc;
+    riru->getJNINativeMethodFunc = api::getNativeMethodFunc;
+    riru->setJNINativeMethodFunc = api::setNativeMethodFunc;
+    riru->getOriginalJNINativeMethodFunc = api::getOriginalNativeMethod;
+    riru->getGlobalValue = api::getGlobalValue;
+    riru->putGlobalValue = api::putGlobalValue;
+    riru->addStringPredicate = api::addStringPredicate;
+    riru->findMappings = api::findMappings;
+    riru->publishBlob = api::publishBlob;
+    riru->publishBlobFile = api::publishBlobFile;
+    riru->getBlob = api::getBlob;
+
+    return (RiruModuleInfoV10 *) init(riru);
+}
+
+static void unload(void *handle, const char *path, std::vector<char *> &failed) {
     if (dlclose(handle) != 0) {
         LOGE("dlclose failed: %s", dlerror());
         return;
     }
+    failed.push_back(strdup(path));
+}
+
+/*
+ * Unmap what the linker leaves of the modules failed to load, from one snapshot for all of them.
+ */
+static void cleanup(maps::snapshot &snapshot, std::vector<char *> &failed) {
+    if (failed.empty()) return;
 
-    procmaps_iterator *maps = pmparser_parse(-1);
-    if (maps == nullptr) {
+    if (snapshot.ensure() == -1) {
         LOGE("cannot parse the memory map");
         return;
     }
 
-    procmaps_struct *maps_tmp;
-    while ((maps_tmp = pmparser_next(maps)) != nullptr) {
-        if (strcmp(maps_tmp->pathname, path) != 0) continue;
+    for (auto path : failed) {
+        auto id = snapshot.find_path(path);
+        if (id != maps::snapshot::NO_PATH) {
+            std::vector<std::pair<uintptr_t, uintptr_t>> ranges;
+            snapshot.for_each_of_path(id, [&](size_t i) {
+                LOGD("%" PRIxPTR"-%" PRIxPTR" %" PRIx64" %s", snapshot.start(i), snapshot.end(i), snapshot.offset(i), path);
+                ranges.emplace_back(snapshot.start(i), snapshot.end(i));
+            });
+            for (auto &range : ranges) {
+                munmap((void *) range.first, range.second - range.first);
+                snapshot.unmapped(range.first, range.second);
+            }
+        }
+        free(path);
+    }
+    failed.clear();
+}
+
+/*
+ * dlopen the module and run the init handshake.
+ * @return API version of the module, 0 if it failed to load
+ */
+static int load_module(const char *name, const char *path, std::vector<char *> &failed) {
+    const int riruApiVersion = RIRU_API_VERSION;
+
+    auto handle = dlopen(path, 0);
+    if (!handle) {
+        LOGE("dlopen %s failed: %s", path, dlerror());
+        return 0;
+    }
+
+    auto init = (RiruInit_t *) dlsym(handle, "init");
+    if (!init) {
+        LOGW("%s does not export init", path);
+        unload(handle, path, failed);
+        return 0;
+    }
+
+    // 1. pass riru api version, return module's api version
+    auto apiVersion = (int *) init((void *) &riruApiVersion);
+    if (apiVersion == nullptr) {
+        LOGE("%s returns null on step 1", path);
+        unload(handle, path, failed);
+        return 0;
+    }
+
+    if (*apiVersion < RIRU_MIN_API_VERSION || *apiVersion > RIRU_API_VERSION) {
+        LOGW("unsupported API %s: %d", name, *apiVersion);
+        unload(handle, path, failed);
+        return 0;
+    }
+
+    // 2. create and pass Riru struct by module's api version
+    // modules live as long as zygote
+    auto module = arena::make<RiruModule>(arena::strdup(name));
+    module->handle = handle;
+    module->apiVersion = *apiVersion;
 
-        auto start = (uintptr_t) maps_tmp->addr_start;
-        auto end = (uintptr_t) maps_tmp->addr_end;
-        auto size = end - start;
-        LOGD("%" PRIxPTR"-%" PRIxPTR" %s %ld %s", start, end, maps_tmp->perm, maps_tmp->offset, maps_tmp->pathname);
-        munmap((void *) start, size);
+    if (*apiVersion == 10) {
+        auto info = init_module_v10(module->token, init);
+        if (info == nullptr) {
+            LOGE("%s returns null on step 2", path);
+            unload(handle, path, failed);
+            return 0;
+        }
+        module->info(info);
+    } else if (*apiVersion == 9) {
+        auto info = init_module_v9(module->token, init);
+        if (info == nullptr) {
+            LOGE("%s returns null on step 2", path);
+            unload(handle, path, failed);
+            return 0;
+        }
+        module->info(info);
     }
-    pmparser_free(maps);
+
+    // 3. let the module to do some cleanup jobs
+    init(nullptr);
+
+    get_modules()->push_back(module);
+
+    LOGI("module loaded: %s (api %d)", module->name, module->apiVersion);
+    return module->apiVersion;
 }
 
-void load_modules() {
+/*
+ * One record (state unknown) for each directory in MODULES_DIR.
+ */
+static bool scan_modules(std::vector<manifest::record> &records) {
     DIR *dir;
     struct dirent *entry;
-    char path[PATH_MAX];
-    void *handle;
-    const int riruApiVersion = RIRU_API_VERSION;
 
-    if (!(dir = _opendir(MODULES_DIR))) return;
+    if (!(dir = _opendir(MODULES_DIR))) return false;
 
     while ((entry = _readdir(dir))) {
         if (entry->d_type != DT_DIR) continue;
@@ -69,91 +183,391 @@ void load_modules() {
         auto name = entry->d_name;
         if (name[0] == '.') continue;
 
+        manifest::record record{};
+        if (strlen(name) >= sizeof(record.name)) {
+            LOGW("module name too long: %s", name);
+            continue;
+        }
+        strcpy(record.name, name);
+        record.state = manifest::STATE_MISSING;
+        records.push_back(record);
+    }
+
+    closedir(dir);
+    return true;
+}
+
+/*
+ * Read the lines of MODULES_DIR/<name>/<file>, blank lines and # comments are skipped.
+ * @return true if the file exists
+ */
+static bool read_lines(const char *name, const char *file_name, std::vector<std::string> &lines) {
+    char path[PATH_MAX];
+    snprintf(path, PATH_MAX, MODULES_DIR "/%s/%s", name, file_name);
+
+    auto file = fopen(path, "re");
+    if (!file) return false;
+
+    char line[PATH_MAX];
+    while (fgets(line, sizeof(line), file)) {
+        auto value = trim(line);
+        if (value[0] == '\0' || value[0] == '#') continue;
+        lines.emplace_back(value);
+    }
+    fclose(file);
+    return true;
+}
+
+static void copy_lines(const std::vector<std::string> &lines, arena::string_list &list) {
+    for (auto &line : lines) {
+        list.push_back(arena::strdup(line.c_str()));
+    }
+}
+
+static bool any_trim = false;
+
+static void read_trim(RiruModule *module) {
+    std::vector<std::string> lines;
+    if (!read_lines(module->name, "trim", lines)) return;
+
+    for (auto &line : lines) {
+        if (line == "@unmap") {
+            module->trimUnmap = true;
+        } else if (line[0] == '@') {
+            LOGW("%s: unknown trim option %s", module->name, line.c_str());
+        } else {
+            module->trimTargets.push_back(arena::strdup(line.c_str()));
+        }
+    }
+    module->trim = true;
+    any_trim = true;
+}
+
+static bool is_loaded(const char *name) {
+    for (auto module : *get_modules()) {
+        if (strcmp(module->name, name) == 0) return true;
+    }
+    for (auto module : *get_on_demand_modules()) {
+        if (strcmp(module->name, name) == 0) return true;
+    }
+    return false;
+}
+
+/*
+ * Load the modules of records which are not loaded yet and update their states.
+ * @param known the states of records are from a previous load, libraries which failed and have
+ * not changed since are skipped
+ */
+static void load_records(std::vector<manifest::record> &records, bool known, std::vector<char *> &failed) {
+    char path[PATH_MAX];
+
+    for (auto &record : records) {
+        auto name = record.name;
+        if (is_loaded(name)) continue;
+
         snprintf(path, PATH_MAX, MODULE_PATH_FMT, name);
 
-        if (access(path, F_OK) != 0) {
+        struct stat st{};
+        if (stat(path, &st) != 0) {
             PLOGE("access %s", path);
+            record.state = manifest::STATE_MISSING;
+            record.api = 0;
+            record.mtime = record.size = 0;
             continue;
         }
 
-        handle = dlopen(path, 0);
-        if (!handle) {
-            LOGE("dlopen %s failed: %s", path, dlerror());
+        std::vector<std::string> targets;
+        if (read_lines(name, "targets", targets)) {
+            LOGI("module %s is loaded on demand (%zu targets)", name, targets.size());
+            auto module = arena::make<RiruOnDemandModule>();
+            module->name = arena::strdup(name);
+            copy_lines(targets, module->targets);
+            get_on_demand_modules()->push_back(module);
+            record.set_file(st);
+            record.api = 0;
+            record.state = manifest::STATE_ON_DEMAND;
             continue;
         }
 
-        auto init = (RiruInit_t *) dlsym(handle, "init");
-        if (!init) {
-            LOGW("%s does not export init", path);
-            cleanup(handle, path);
+        if (known && record.state == manifest::STATE_FAILED && record.same_file(st)) {
+            LOGI("skip %s, it failed to load before", name);
             continue;
         }
 
-        // 1. pass riru api version, return module's api version
-        auto apiVersion = (int *) init((void *) &riruApiVersion);
-        if (apiVersion == nullptr) {
-            LOGE("%s returns null on step 1", path);
-            cleanup(handle, path);
-            continue;
-        }
+        record.set_file(st);
+        record.api = (uint16_t) load_module(name, path, failed);
+        record.state = record.api ? manifest::STATE_LOADED : manifest::STATE_FAILED;
 
-        if (*apiVersion < RIRU_MIN_API_VERSION || *apiVersion > RIRU_API_VERSION) {
-            LOGW("unsupported API %s: %d", name, *apiVersion);
-            cleanup(handle, path);
-            continue;
+        if (record.api) {
+            auto module = get_modules()->back();
+            std::vector<std::string> after;
+            module->parallelInit = read_lines(name, "parallel", after);
+            copy_lines(after, module->initAfter);
+            read_trim(module);
         }
+    }
+}
+
+// libriru is hidden with the first modules, or by hide_riru when those are loaded in background
+static bool riru_hidden = false;
+static bool riru_hide_deferred = false;
 
-        // 2. create and pass Riru struct by module's api version
-        auto module = new RiruModule(strdup(name));
-        module->handle = handle;
-        module->apiVersion = *apiVersion;
+/*
+ * Hide the modules loaded from first on, unmap what is left of the failed ones and call
+ * onModuleLoaded of the new ones.
+ */
+static void finish_loading(size_t first, std::vector<char *> &failed, hide_mode mode) {
+    // read once after all modules are loaded, shared by the cleanup and the hide
+    maps::snapshot snapshot;
+    auto modules = get_modules();
 
-        if (*apiVersion == 9) {
-            auto info = init_module_v9(module->token, init);
-            if (info == nullptr) {
-                LOGE("%s returns null on step 2", path);
-                cleanup(handle, path);
+    if (status::getStatus()->hideEnabled) {
+        std::vector<const char *> names;
+        for (auto i = first; i < modules->size(); ++i) {
+            auto module = (*modules)[i];
+            if (strcmp(module->name, MODULE_NAME_CORE) == 0) continue;
+            if (!module->supportHide) {
+                LOGI("module %s does not support hide", module->name);
                 continue;
             }
-            module->info(info);
+            names.push_back(module->name);
         }
+        auto hide_riru_now = !riru_hidden && !riru_hide_deferred;
+        if (!names.empty() || hide_riru_now) {
+            hide::hide_modules(snapshot, names.data(), (int) names.size(), mode, hide_riru_now);
+            if (hide_riru_now) riru_hidden = true;
+        }
+    }
 
-        // 3. let the module to do some cleanup jobs
-        init(nullptr);
+    cleanup(snapshot, failed);
 
-        get_modules()->push_back(module);
+    // modules with a parallel file run on a few threads, joined before any fork
+    std::vector<init_pool::task> tasks;
+    std::vector<RiruModule *> loaded;
+    for (auto i = first; i < modules->size(); ++i) {
+        auto module = (*modules)[i];
+        if (!module->hasOnModuleLoaded()) continue;
 
-        LOGI("module loaded: %s (api %d)", module->name, module->apiVersion);
+        tasks.push_back({[](void *arg) {
+            auto module = (RiruModule *) arg;
+            LOGV("%s: onModuleLoaded", module->name);
+
+            module->onModuleLoaded();
+        }, module, module->parallelInit, {}});
+        loaded.push_back(module);
     }
 
-    closedir(dir);
+    // modules loaded before or without onModuleLoaded are done already
+    for (auto &task : tasks) {
+        for (auto &after : ((RiruModule *) task.arg)->initAfter) {
+            for (size_t j = 0; j < loaded.size(); ++j) {
+                if (strcmp(after, loaded[j]->name) == 0) task.after.push_back(j);
+            }
+        }
+    }
+    init_pool::run(tasks);
+}
 
+// records of the last load and MODULES_DIR mtime at that time, the generation checked before forks
+static std::vector<manifest::record> *module_records = new std::vector<manifest::record>();
+static int64_t modules_dir_mtime = 0;
+
+void load_modules(bool background) {
+    std::vector<char *> failed;
+    riru_hide_deferred = background;
+
+    // the directory is scanned again only when a module is added or removed
+    auto dir_mtime = manifest::mtime_of(MODULES_DIR);
+    std::vector<manifest::record> records, cached;
+    bool from_manifest = manifest::read(MODULES_MANIFEST_FILE, dir_mtime, cached) == 0;
+    if (from_manifest) {
+        LOGD("%zu modules from " MODULES_MANIFEST_FILE, cached.size());
+        records = cached;
+    } else if (!scan_modules(records)) {
+        return;
+    }
+
+    // before the modules are initialized, they may publish blobs from init already
+    auto mode = HIDE_MODE_MREMAP;
     status::getStatus()->hideEnabled = access(ENABLE_HIDE_FILE, F_OK) == 0;
     if (status::getStatus()->hideEnabled) {
         LOGI("hide is enabled");
-        auto modules = get_modules();
-        auto names = (const char **) malloc(sizeof(char *) * modules->size());
-        int names_count = 0;
-        for (auto module : *get_modules()) {
-            if (strcmp(module->name, MODULE_NAME_CORE) == 0) continue;
-            if (!module->supportHide) {
-                LOGI("module %s does not support hide", module->name);
-                continue;
-            }
-            names[names_count] = module->name;
-            names_count += 1;
-        }
-        hide::hide_modules(names, names_count);
+        mode = hide::read_mode(HIDE_MODE_FILE);
+        // no fork follows in an app to finish a lazy hide
+        on_demand_hide_mode = mode == HIDE_MODE_LAZY ? HIDE_MODE_MREMAP : mode;
     } else {
         PLOGE("access " ENABLE_HIDE_FILE);
         LOGI("hide is not enabled");
     }
 
-    for (auto module : *get_modules()) {
-        if (module->hasOnModuleLoaded()) {
-            LOGV("%s: onModuleLoaded", module->name);
+    auto first = get_modules()->size();
+    load_records(records, from_manifest, failed);
 
-            module->onModuleLoaded();
+    if (!from_manifest || records.size() != cached.size()
+        || memcmp(records.data(), cached.data(), sizeof(manifest::record) * records.size()) != 0) {
+        manifest::write(MODULES_MANIFEST_FILE, dir_mtime, records);
+    }
+    *module_records = records;
+    modules_dir_mtime = dir_mtime;
+
+    finish_loading(first, failed, mode);
+}
+
+void hide_riru() {
+    riru_hide_deferred = false;
+    if (!status::getStatus()->hideEnabled || riru_hidden) return;
+
+    maps::snapshot snapshot;
+    hide::hide_modules(snapshot, nullptr, 0, on_demand_hide_mode);
+    riru_hidden = true;
+}
+
+void load_new_modules() {
+    // one stat per fork while nothing changes
+    auto dir_mtime = manifest::mtime_of(MODULES_DIR);
+    if (dir_mtime == modules_dir_mtime) return;
+
+    LOGI("%s changed, looking for new modules", MODULES_DIR);
+    arena::scope writable;
+
+    std::vector<manifest::record> records;
+    if (!scan_modules(records)) return;
+
+    // the modules seen before keep their states
+    std::vector<bool> known(records.size(), false);
+    for (size_t i = 0; i < records.size(); ++i) {
+        for (auto &record : *module_records) {
+            if (strcmp(records[i].name, record.name) == 0) {
+                records[i] = record;
+                known[i] = true;
+                break;
+            }
         }
     }
-}
\ No newline at end of file
+
+    std::vector<char *> failed;
+    auto first = get_modules()->size();
+    auto on_demand = get_on_demand_modules()->size();
+    load_records(records, true, failed);
+
+    manifest::write(MODULES_MANIFEST_FILE, dir_mtime, records);
+
+    // the directory of a module is often created before its library is in place, and its
+    // mtime does not change when the library comes: new modules without a library stay new
+    // and MODULES_DIR is scanned again before each fork until all of them are resolved
+    bool pending = false;
+    module_records->clear();
+    for (size_t i = 0; i < records.size(); ++i) {
+        if (!known[i] && records[i].state == manifest::STATE_MISSING) {
+            LOGI("library of %s is not there yet, look again before the next fork", records[i].name);
+            pending = true;
+            continue;
+        }
+        module_records->push_back(records[i]);
+    }
+    if (!pending) modules_dir_mtime = dir_mtime;
+
+    if (get_modules()->size() == first && get_on_demand_modules()->size() == on_demand && failed.empty()) {
+        return;
+    }
+    LOGI("%zu new modules, %zu on demand", get_modules()->size() - first, get_on_demand_modules()->size() - on_demand);
+
+    finish_loading(first, failed, status::getStatus()->hideEnabled ? hide::read_mode(HIDE_MODE_FILE) : HIDE_MODE_MREMAP);
+    status::writeToFile();
+}
+
+static bool targets_process(const arena::string_list &targets, const char *process) {
+    auto colon = strchr(process, ':');
+    auto package_length = colon ? (size_t) (colon - process) : strlen(process);
+
+    for (auto target : targets) {
+        if (strcmp(target, process) == 0) return true;
+
+        // a package name targets all processes of the package
+        if (!strchr(target, ':') && strlen(target) == package_length
+            && strncmp(target, process, package_length) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void load_on_demand_modules(const char *process) {
+    if (!process || !*process || get_on_demand_modules()->empty()) return;
+
+    arena::scope writable;
+    char path[PATH_MAX];
+    std::vector<char *> failed;
+    auto first = get_modules()->size();
+
+    for (auto module : *get_on_demand_modules()) {
+        if (!targets_process(module->targets, process)) continue;
+
+        snprintf(path, PATH_MAX, MODULE_PATH_FMT, module->name);
+        load_module(module->name, path, failed);
+    }
+
+    finish_loading(first, failed, on_demand_hide_mode);
+}
+
+bool process_name_needed() {
+    return any_trim || !get_on_demand_modules()->empty();
+}
+
+#ifndef MADV_COLD
+#define MADV_COLD 20
+#endif
+
+/*
+ * MADV_COLD the loaded segments of the image at path: the pages are the first to be reclaimed,
+ * their content is kept for the code which could still run (e.g. hooks set in zygote).
+ */
+static void cool_image(const char *path) {
+    dl_iterate_phdr([](struct dl_phdr_info *info, size_t, void *data) -> int {
+        if (!info->dlpi_name || strcmp(info->dlpi_name, (const char *) data) != 0) return 0;
+
+        auto page_size = (uintptr_t) sysconf(_SC_PAGESIZE);
+        for (int i = 0; i < info->dlpi_phnum; ++i) {
+            auto &phdr = info->dlpi_phdr[i];
+            if (phdr.p_type != PT_LOAD) continue;
+
+            auto start = (info->dlpi_addr + phdr.p_vaddr) & ~(page_size - 1);
+            auto end = (info->dlpi_addr + phdr.p_vaddr + phdr.p_memsz + page_size - 1) & ~(page_size - 1);
+            // MADV_COLD is from Linux 5.4, nothing else releases the pages without losing them
+            if (madvise((void *) start, end - start, MADV_COLD) == -1 && errno != EINVAL) {
+                PLOGE("madvise %" PRIxPTR"-%" PRIxPTR, start, end);
+            }
+        }
+        return 1;
+    }, (void *) path);
+}
+
+void trim_modules(const char *process) {
+    if (!any_trim || !process || !*process) return;
+
+    char path[PATH_MAX];
+    auto modules = get_modules();
+    arena::scope writable;
+
+    for (auto module : *modules) {
+        if (!module->trim || module->trimmed || targets_process(module->trimTargets, process)) continue;
+
+        // functions set for the other modules may be called through pointers taken already
+        bool unmap = module->trimUnmap;
+        if (unmap && !module->funcs->empty()) {
+            LOGW("%s has set functions, not unmapped", module->name);
+            unmap = false;
+        }
+
+        LOGD("trim %s%s", module->name, unmap ? " (unmap)" : "");
+        module->trimmed = true;
+        // callbacks called by the core, not by the module
+        predicate::remove(module->token);
+        snprintf(path, PATH_MAX, MODULE_PATH_FMT, module->name);
+        if (!unmap) {
+            cool_image(path);
+        } else if (dlclose(module->handle) != 0) {
+            LOGE("dlclose %s failed: %s", module->name, dlerror());
+        }
+    }
+}
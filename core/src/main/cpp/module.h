@@ -5,6 +5,7 @@
 #include <map>
 #include <vector>
 #include "api.h"
+#include "arena.h"
 
 #define MODULE_NAME_CORE "core"
 
@@ -16,12 +17,28 @@ public:
     uint32_t token;
 
     void *handle{};
-    std::map<std::string, void *> *funcs;
+    // keys and map are in the arena
+    using func_map = std::map<const char *, void *, arena::less_str, arena::allocator<std::pair<const char *const, void *>>>;
+    func_map *funcs;
 
     int supportHide;
     int version;
     const char *versionName;
 
+    // from MODULES_DIR/<name>/parallel: onModuleLoaded is thread safe and runs after the
+    // onModuleLoaded of the modules listed
+    bool parallelInit = false;
+    arena::string_list initAfter;
+
+    // from MODULES_DIR/<name>/trim: the processes the module is for, it is trimmed from the
+    // others after they are forked, and unloaded there with an "@unmap" line
+    bool trim = false;
+    bool trimUnmap = false;
+    arena::string_list trimTargets;
+    // trimmed from this process: kept in the list (getFunc chains by index), but its hooks and
+    // functions are skipped
+    bool trimmed = false;
+
 private:
     void *_onModuleLoaded;
     void *_shouldSkipUid;
@@ -34,7 +51,7 @@ private:
 
 public:
     explicit RiruModule(const char *name, uint32_t token = 0) : name(name), token(token ? token : (uintptr_t) name) {
-        funcs = new std::map<std::string, void *>();
+        funcs = arena::make<func_map>();
         apiVersion = 0;
         handle = nullptr;
         _onModuleLoaded = nullptr;
@@ -50,7 +67,7 @@ public:
     void info(RiruModuleInfoV9 *info) {
         supportHide = info->supportHide;
         version = info->version;
-        versionName = strdup(info->versionName ? info->versionName : "(null)");
+        versionName = arena::strdup(info->versionName ? info->versionName : "(null)");
         _onModuleLoaded = (void *) info->onModuleLoaded;
         _shouldSkipUid = (void *) info->shouldSkipUid;
         _forkAndSpecializePre = (void *) info->forkAndSpecializePre;
@@ -94,13 +111,13 @@ public:
     }
 
     void onModuleLoaded() {
-        if (apiVersion == 9) {
+        if (apiVersion >= 9) {
             ((onModuleLoaded_v9 *) _onModuleLoaded)();
         }
     }
 
     bool shouldSkipUid(int uid) {
-        if (apiVersion == 9) {
+        if (apiVersion >= 9) {
             return ((shouldSkipUid_v9 *) _shouldSkipUid)(uid);
         }
         return false;
@@ -113,7 +130,7 @@ public:
             jstring *instructionSet, jstring *appDataDir, jboolean *isTopApp, jobjectArray *pkgDataInfoList,
             jobjectArray *whitelistedDataInfoList, jboolean *bindMountAppDataDirs, jboolean *bindMountAppStorageDirs) {
 
-        if (apiVersion == 9) {
+        if (apiVersion >= 9) {
             ((nativeForkAndSpecializePre_v9 *) _forkAndSpecializePre)(
                     env, cls, uid, gid, gids, runtimeFlags, rlimits, mountExternal,
                     seInfo, niceName, fdsToClose, fdsToIgnore, is_child_zygote,
@@ -123,7 +140,7 @@ public:
     }
 
     void forkAndSpecializePost(JNIEnv *env, jclass cls, jint res) {
-        if (apiVersion == 9) {
+        if (apiVersion >= 9) {
             ((nativeForkAndSpecializePost_v9 *) _forkAndSpecializePost)(
                     env, cls, res);
         }
@@ -133,7 +150,7 @@ public:
             JNIEnv *env, jclass cls, uid_t *uid, gid_t *gid, jintArray *gids, jint *runtimeFlags,
             jobjectArray *rlimits, jlong *permittedCapabilities, jlong *effectiveCapabilities) {
 
-        if (apiVersion == 9) {
+        if (apiVersion >= 9) {
             ((nativeForkSystemServerPre_v9 *) _forkSystemServerPre)(
                     env, cls, uid, gid, gids, runtimeFlags, rlimits, permittedCapabilities,
                     effectiveCapabilities);
@@ -141,7 +158,7 @@ public:
     }
 
     void forkSystemServerPost(JNIEnv *env, jclass cls, jint res) {
-        if (apiVersion == 9) {
+        if (apiVersion >= 9) {
             ((nativeForkSystemServerPost_v9 *) _forkSystemServerPost)(
                     env, cls, res);
         }
@@ -154,7 +171,7 @@ public:
             jboolean *isTopApp, jobjectArray *pkgDataInfoList, jobjectArray *whitelistedDataInfoList,
             jboolean *bindMountAppDataDirs, jboolean *bindMountAppStorageDirs) {
 
-        if (apiVersion == 9) {
+        if (apiVersion >= 9) {
             ((nativeSpecializeAppProcessPre_v9 *) _specializeAppProcessPre)(
                     env, cls, uid, gid, gids, runtimeFlags, rlimits, mountExternal, seInfo,
                     niceName, startChildZygote, instructionSet, appDataDir, isTopApp,
@@ -163,13 +180,65 @@ public:
     }
 
     void specializeAppProcessPost(JNIEnv *env, jclass cls) {
-        if (apiVersion == 9) {
+        if (apiVersion >= 9) {
             ((nativeSpecializeAppProcessPost_v9 *) _specializeAppProcessPost)(
                     env, cls);
         }
     }
 };
 
-std::vector<RiruModule *> *get_modules();
+/**
+ * A module loaded only in the processes it targets, declared by a "targets" file in its
+ * directory of MODULES_DIR: one process name ("com.example:remote") or package name (all
+ * processes of the package) per line.
+ *
+ * It is not loaded in zygote, so it gets onModuleLoaded and the post hooks only.
+ */
+struct RiruOnDemandModule {
+    const char *name;
+    arena::string_list targets;
+};
 
-void load_modules();
\ No newline at end of file
+using module_list = std::vector<RiruModule *, arena::allocator<RiruModule *>>;
+
+module_list *get_modules();
+
+using on_demand_module_list = std::vector<RiruOnDemandModule *, arena::allocator<RiruOnDemandModule *>>;
+
+on_demand_module_list *get_on_demand_modules();
+
+/**
+ * Load the modules, hide them and call their onModuleLoaded.
+ * @param background it runs on a thread while the main thread goes on, libriru is left to
+ * hide_riru() then as its code and data are in use there
+ */
+void load_modules(bool background = false);
+
+/**
+ * Hide libriru if load_modules(true) left it, on the main thread after the loading thread is joined.
+ */
+void hide_riru();
+
+/**
+ * In zygote, before a fork: if MODULES_DIR changed since the last load, load the modules added
+ * since, hide them and call their onModuleLoaded.
+ */
+void load_new_modules();
+
+/**
+ * In a forked process, before the post hooks: load the on-demand modules targeting process,
+ * hide them and call their onModuleLoaded.
+ */
+void load_on_demand_modules(const char *process);
+
+/**
+ * In a forked process, before the post hooks: mark the modules with a trim file which do not
+ * target process as trimmed, so none of their hooks run there, and release their memory
+ * (MADV_COLD), or unload them if they allow it and have set no functions.
+ */
+void trim_modules(const char *process);
+
+/**
+ * @return whether the name of the forked process is used, by on-demand or trimmed modules
+ */
+bool process_name_needed();
\ No newline at end of file
@@ -0,0 +1,63 @@
+#include <atomic>
+#include <cstring>
+#include <pthread.h>
+#include <unistd.h>
+#include "parallel_copy.h"
+#include "logging.h"
+
+namespace hide {
+
+    static constexpr size_t CHUNK_SIZE = 1024 * 1024;
+    static constexpr int MAX_THREADS = 8;
+
+    namespace {
+        struct copy_job {
+            char *dst;
+            const char *src;
+            size_t length;
+            std::atomic<size_t> next;
+        };
+    }
+
+    static void *copy_chunks(void *arg) {
+        auto job = (copy_job *) arg;
+        size_t offset;
+        // chunks are taken one by one, a thread stalled by page faults does not hold up the rest
+        while ((offset = job->next.fetch_add(CHUNK_SIZE)) < job->length) {
+            auto size = job->length - offset < CHUNK_SIZE ? job->length - offset : CHUNK_SIZE;
+            memcpy(job->dst + offset, job->src + offset, size);
+        }
+        return nullptr;
+    }
+
+    void parallel_copy(void *dst, const void *src, size_t length, int threads) {
+        if (threads <= 0) {
+            threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+        }
+        if (threads > MAX_THREADS) threads = MAX_THREADS;
+        // each thread should get a few chunks at least
+        auto useful = (int) (length / (PARALLEL_COPY_MIN / 4));
+        if (threads > useful) threads = useful;
+
+        if (length < PARALLEL_COPY_MIN || threads <= 1) {
+            memcpy(dst, src, length);
+            return;
+        }
+
+        copy_job job{(char *) dst, (const char *) src, length, {0}};
+        pthread_t workers[MAX_THREADS];
+        int started = 0;
+        for (; started < threads - 1; ++started) {
+            if (pthread_create(&workers[started], nullptr, copy_chunks, &job) != 0) {
+                LOGW("pthread_create failed, copy with %d threads", started + 1);
+                break;
+            }
+        }
+
+        copy_chunks(&job);
+
+        for (int i = 0; i < started; ++i) {
+            pthread_join(workers[i], nullptr);
+        }
+    }
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <cstddef>
+
+namespace hide {
+
+    // below this a copy stays on the calling thread
+    constexpr size_t PARALLEL_COPY_MIN = 8 * 1024 * 1024;
+
+    /**
+     * memcpy which splits large copies into chunks copied by the calling thread and up to
+     * threads - 1 temporary threads (0 for one per online CPU, at most 8). All threads are
+     * joined before returning, the process is as single threaded as it was.
+     */
+    void parallel_copy(void *dst, const void *src, size_t length, int threads = 0);
+}
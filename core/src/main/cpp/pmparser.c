@@ -19,18 +19,24 @@ implied warranty.
 //procmaps_struct* g_last_head=NULL;
 //procmaps_struct* g_current=NULL;
 
+#ifdef __ANDROID__
 #include "android/log.h"
 
 #define printf(...) __android_log_print(ANDROID_LOG_DEBUG, "TAG", __VA_ARGS__);
+#endif
 
 procmaps_iterator* pmparser_parse(int pid){
-	procmaps_iterator* maps_it = malloc(sizeof(procmaps_iterator));
 	char maps_path[500];
 	if(pid>=0 ){
 		sprintf(maps_path,"/proc/%d/maps",pid);
 	}else{
 		sprintf(maps_path,"/proc/self/maps");
 	}
+	return pmparser_parse_file(maps_path);
+}
+
+procmaps_iterator* pmparser_parse_file(const char* maps_path){
+	procmaps_iterator* maps_it = malloc(sizeof(procmaps_iterator));
 	FILE* file=fopen(maps_path,"r");
 	if(!file){
 		fprintf(stderr,"pmparser : cannot open the memory maps, %s\n",strerror(errno));
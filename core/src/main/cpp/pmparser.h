@@ -70,6 +70,13 @@ typedef struct procmaps_iterator{
  */
 procmaps_iterator* pmparser_parse(int pid);
 
+/**
+ * pmparser_parse_file
+ * @param maps_path path of a file in the format of /proc/<pid>/maps
+ * @return an iterator over all the nodes
+ */
+procmaps_iterator* pmparser_parse_file(const char* maps_path);
+
 /**
  * pmparser_next
  * @description move between areas
@@ -0,0 +1,153 @@
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "config.h"
+
+/*
+ * Bring libriru and the module libraries of both ABIs into the page cache before zygote starts,
+ * run in the background from post-fs-data.sh.
+ *
+ * usage: riruprewarm [-d] [-m modules_dir] [-r root]... [file...]
+ *   -d  drop the files from the page cache first (POSIX_FADV_DONTNEED), a cold cache for tests
+ *   -m  directory of the module names (default MODULES_DIR)
+ *   -r  look for system/lib and system/lib64 under root, default "/" and each Magisk module
+ *       (Magisk has not mounted them over /system yet when post-fs-data.sh runs)
+ *   file  prewarm these files as well
+ *
+ * Each file is printed as one tab separated line, with how much was cached before:
+ *
+ *   <path> <size KB> <cached KB>
+ */
+
+#define MAGISK_MODULES_DIR "/data/adb/modules"
+
+static const char *lib_dirs[] = {"system/lib/", "system/lib64/"};
+
+static bool drop = false;
+
+/*
+ * @return pages of the file in the page cache, -1 on error
+ */
+static long cached_pages(int fd, size_t size) {
+    if (size == 0) return 0;
+
+    auto addr = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) return -1;
+
+    auto page_size = (size_t) sysconf(_SC_PAGESIZE);
+    std::vector<unsigned char> vec((size + page_size - 1) / page_size);
+    long count = -1;
+    if (mincore(addr, size, vec.data()) == 0) {
+        count = 0;
+        for (auto v : vec) {
+            if (v & 1) count++;
+        }
+    }
+    munmap(addr, size);
+    return count;
+}
+
+static void prewarm(const char *path, std::set<std::pair<dev_t, ino_t>> &done) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return;
+
+    struct stat st{};
+    // the same file may be found from several roots once mounted
+    if (fstat(fd, &st) == -1 || !done.emplace(st.st_dev, st.st_ino).second) {
+        close(fd);
+        return;
+    }
+
+    if (drop) posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+
+    auto cached = cached_pages(fd, (size_t) st.st_size);
+
+    // starts the reads and returns
+    int res = posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+    if (res != 0) fprintf(stderr, "fadvise %s: %s\n", path, strerror(res));
+    close(fd);
+
+    printf("%s\t%ld\t%ld\n", path, (long) (st.st_size / 1024),
+           cached < 0 ? -1 : cached * (sysconf(_SC_PAGESIZE) / 1024));
+}
+
+static void list_dir(const char *path, bool dirs_only, std::vector<std::string> &names) {
+    DIR *dir = opendir(path);
+    if (!dir) return;
+
+    struct dirent *entry;
+    while ((entry = readdir(dir))) {
+        if (entry->d_name[0] == '.') continue;
+        if (dirs_only && entry->d_type != DT_DIR) continue;
+        names.emplace_back(entry->d_name);
+    }
+    closedir(dir);
+}
+
+static void default_roots(std::vector<std::string> &roots) {
+    roots.emplace_back("/");
+
+    std::vector<std::string> modules;
+    list_dir(MAGISK_MODULES_DIR, true, modules);
+    for (auto &module : modules) {
+        auto root = std::string(MAGISK_MODULES_DIR "/") + module + "/";
+        if (access((root + "disable").c_str(), F_OK) == 0 || access((root + "remove").c_str(), F_OK) == 0) continue;
+        roots.push_back(root);
+    }
+}
+
+int main(int argc, char **argv) {
+    const char *modules_dir = MODULES_DIR;
+    std::vector<std::string> roots;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "dm:r:")) != -1) {
+        switch (opt) {
+            case 'd':
+                drop = true;
+                break;
+            case 'm':
+                modules_dir = optarg;
+                break;
+            case 'r':
+                roots.emplace_back(std::string(optarg) + "/");
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-d] [-m modules_dir] [-r root]... [file...]\n", argv[0]);
+                return 2;
+        }
+    }
+    if (roots.empty()) default_roots(roots);
+
+    std::vector<std::string> names;
+    list_dir(modules_dir, true, names);
+
+    std::vector<std::string> libraries = {"libriru.so", "libriruloader.so"};
+    for (auto &name : names) {
+        libraries.push_back("libriru_" + name + ".so");
+    }
+
+    std::set<std::pair<dev_t, ino_t>> done;
+    for (auto &root : roots) {
+        for (auto lib_dir : lib_dirs) {
+            for (auto &library : libraries) {
+                prewarm((root + lib_dir + library).c_str(), done);
+            }
+        }
+    }
+    for (int i = optind; i < argc; ++i) {
+        prewarm(argv[i], done);
+    }
+    return 0;
+}
@@ -43,4 +43,20 @@ void *_mmap(void *addr, size_t size, int prot, int flags, int fd, off_t offset)
         PLOGE("mmap");
     }
     return res;
-}
\ No newline at end of file
+}
+
+int _munmap(void *addr, size_t size) {
+    int res = munmap(addr, size);
+    if (res != 0) {
+        PLOGE("munmap");
+    }
+    return res;
+}
+
+void *_mremap(void *old_addr, size_t old_size, size_t new_size, int flags, void *new_addr) {
+    auto res = mremap(old_addr, old_size, new_size, flags, new_addr);
+    if (res == MAP_FAILED) {
+        PLOGE("mremap");
+    }
+    return res;
+}
@@ -11,4 +11,8 @@ int _mprotect(void *addr, size_t size, int prot);
 
 void *_mmap(void *addr, size_t size, int prot, int flags, int fd, off_t offset);
 
+int _munmap(void *addr, size_t size);
+
+void *_mremap(void *old_addr, size_t old_size, size_t new_size, int flags, void *new_addr);
+
 #endif // _WRAP_H
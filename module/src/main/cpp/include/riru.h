@@ -11,6 +11,12 @@ extern "C" {
 
 // ---------------------------------------------------------
 
+/*
+ * Called in zygote once the module is loaded, before the JNI methods of the framework are
+ * registered, unless /data/adb/riru/background_load exists: then init and onModuleLoaded of all
+ * modules run on another thread while zygote starts, possibly after those registrations, and
+ * only before the first fork is guaranteed.
+ */
 typedef void(onModuleLoaded_v9)();
 
 typedef int(shouldSkipUid_v9)(int uid);
@@ -53,6 +59,9 @@ typedef struct {
     nativeSpecializeAppProcessPost_v9 *specializeAppProcessPost;
 } RiruModuleInfoV9;
 
+// unchanged in v10
+typedef RiruModuleInfoV9 RiruModuleInfoV10;
+
 // ---------------------------------------------------------
 
 typedef void *(RiruGetFunc_v9)(uint32_t token, const char *name);
@@ -81,6 +90,55 @@ typedef struct {
     RiruPutGlobalValue_v9 *putGlobalValue;
 } RiruApiV9;
 
+/*
+ * Called before the interposed JNI method when the predicate matches.
+ * args are the jstring arguments of the call in declaration order.
+ */
+typedef void(RiruStringPredicateCallback_v10)(JNIEnv *env, const jstring *args, int argc);
+
+typedef int(RiruAddStringPredicate_v10)(
+        uint32_t token, const char *className, const char *name, const char *signature,
+        int argIndex, const char *prefix, const char *suffix, RiruStringPredicateCallback_v10 *callback);
+
+typedef struct {
+    uintptr_t start;
+    uintptr_t end;
+    uint64_t offset;
+    int prot;
+    // "" for anonymous mappings, valid for the process lifetime
+    const char *path;
+} RiruMapping_v10;
+
+typedef int(RiruFindMappings_v10)(
+        uint32_t token, const uintptr_t *addresses, RiruMapping_v10 *mappings, int count, int refresh);
+
+typedef int(RiruPublishBlob_v10)(uint32_t token, const char *name, const void *data, size_t size);
+
+typedef int(RiruPublishBlobFile_v10)(uint32_t token, const char *name, const char *path);
+
+typedef const void *(RiruGetBlob_v10)(uint32_t token, const char *name, size_t *size);
+
+/*
+ * RiruApiV10 starts with all members of RiruApiV9, modules can keep using riru_api_v9 for them.
+ */
+typedef struct {
+
+    uint32_t token;
+    RiruGetFunc_v9 *getFunc;
+    RiruGetJNINativeMethodFunc_v9 *getJNINativeMethodFunc;
+    RiruSetFunc_v9 *setFunc;
+    RiruSetJNINativeMethodFunc_v9 *setJNINativeMethodFunc;
+    RiruGetOriginalJNINativeMethodFunc_v9 *getOriginalJNINativeMethodFunc;
+    RiruGetGlobalValue_v9 *getGlobalValue;
+    RiruPutGlobalValue_v9 *putGlobalValue;
+
+    RiruAddStringPredicate_v10 *addStringPredicate;
+    RiruFindMappings_v10 *findMappings;
+    RiruPublishBlob_v10 *publishBlob;
+    RiruPublishBlobFile_v10 *publishBlobFile;
+    RiruGetBlob_v10 *getBlob;
+} RiruApiV10;
+
 typedef void *(RiruInit_t)(void *);
 
 #ifdef RIRU_MODULE
@@ -114,52 +172,125 @@ extern int riru_api_version;
 extern RiruApiV9 *riru_api_v9;
 
 inline void *riru_get_func(const char *name) {
-    if (riru_api_version == 9) {
+    if (riru_api_version >= 9) {
         return riru_api_v9->getFunc(riru_api_v9->token, name);
     }
     return NULL;
 }
 
 inline void *riru_get_native_method_func(const char *className, const char *name, const char *signature) {
-    if (riru_api_version == 9) {
+    if (riru_api_version >= 9) {
         return riru_api_v9->getJNINativeMethodFunc(riru_api_v9->token, className, name, signature);
     }
     return NULL;
 }
 
 inline const JNINativeMethod *riru_get_original_native_methods(const char *className, const char *name, const char *signature) {
-    if (riru_api_version == 9) {
+    if (riru_api_version >= 9) {
         return riru_api_v9->getOriginalJNINativeMethodFunc(className, name, signature);
     }
     return NULL;
 }
 
 inline void riru_set_func(const char *name, void *func) {
-    if (riru_api_version == 9) {
+    if (riru_api_version >= 9) {
         riru_api_v9->setFunc(riru_api_v9->token, name, func);
     }
 }
 
 inline void riru_set_native_method_func(const char *className, const char *name, const char *signature,
                                  void *func) {
-    if (riru_api_version == 9) {
+    if (riru_api_version >= 9) {
         riru_api_v9->setJNINativeMethodFunc(riru_api_v9->token, className, name, signature, func);
     }
 }
 
 inline void *riru_get_global_value(const char *key) {
-    if (riru_api_version == 9) {
+    if (riru_api_version >= 9) {
         return riru_api_v9->getGlobalValue(key);
     }
     return NULL;
 }
 
 inline void riru_put_global_value(const char *key, void *value) {
-    if (riru_api_version == 9) {
+    if (riru_api_version >= 9) {
         riru_api_v9->putGlobalValue(key, value);
     }
 }
 
+/*
+ * Check a jstring argument of a JNI method interposed by Riru (currently
+ * android.os.SystemProperties#native_set) without decoding it.
+ *
+ * prefix and suffix must be ASCII, either can be null. The callback only runs
+ * when the argument starts with prefix and ends with suffix, so the full decoding
+ * cost is only paid for interesting calls.
+ *
+ * Returns 0 on success, -1 if the method is not interposed or the predicate is invalid.
+ */
+inline int riru_add_string_predicate(const char *className, const char *name, const char *signature,
+                                     int argIndex, const char *prefix, const char *suffix,
+                                     RiruStringPredicateCallback_v10 *callback) {
+    if (riru_api_version >= 10) {
+        return ((RiruApiV10 *) riru_api_v9)->addStringPredicate(
+                riru_api_v9->token, className, name, signature, argIndex, prefix, suffix, callback);
+    }
+    return -1;
+}
+
+/*
+ * Find the mappings containing count addresses with one call, mappings[i] is zeroed
+ * (start == end == 0) if addresses[i] is not mapped.
+ *
+ * The lookup uses an index of the memory map shared by all modules, built on the first
+ * call. Pass refresh = 1 to read the memory map again if it may have changed since.
+ *
+ * Returns the number of addresses found, -1 on error.
+ */
+inline int riru_find_mappings(const uintptr_t *addresses, RiruMapping_v10 *mappings, int count, int refresh) {
+    if (riru_api_version >= 10) {
+        return ((RiruApiV10 *) riru_api_v9)->findMappings(
+                riru_api_v9->token, addresses, mappings, count, refresh);
+    }
+    return -1;
+}
+
+/*
+ * Publish a read-only copy of size bytes of data as name (prefix it with the module name),
+ * e.g. a table built in onModuleLoaded. The copy is made once in zygote, all the processes
+ * forked from it share its pages and get it from riru_get_blob without any copy or parsing.
+ *
+ * Only in zygote (onModuleLoaded or a pre fork hook), a name is published once.
+ * Returns 0 on success, -1 otherwise.
+ */
+inline int riru_publish_blob(const char *name, const void *data, size_t size) {
+    if (riru_api_version >= 10) {
+        return ((RiruApiV10 *) riru_api_v9)->publishBlob(riru_api_v9->token, name, data, size);
+    }
+    return -1;
+}
+
+/*
+ * Like riru_publish_blob, with the content of the file at path, which apps usually cannot read.
+ */
+inline int riru_publish_blob_file(const char *name, const char *path) {
+    if (riru_api_version >= 10) {
+        return ((RiruApiV10 *) riru_api_v9)->publishBlobFile(riru_api_v9->token, name, path);
+    }
+    return -1;
+}
+
+/*
+ * Returns the blob published as name, valid for the process lifetime and read-only (writing
+ * to it crashes), and stores its size in size. NULL if there is no such blob.
+ */
+inline const void *riru_get_blob(const char *name, size_t *size) {
+    if (riru_api_version >= 10) {
+        return ((RiruApiV10 *) riru_api_v9)->getBlob(riru_api_v9->token, name, size);
+    }
+    return NULL;
+}
+
 #endif
 
 #ifdef __cplusplus
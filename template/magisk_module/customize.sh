@@ -41,6 +41,30 @@ if [ ! -f "$TMPDIR/verify.sh" ]; then
 fi
 . $TMPDIR/verify.sh
 
+# libriru built for the API level of the device, the generic one for others and previews
+RIRU_LIB="libriru.so"
+case "$API" in
+  23) RIRU_LIB="libriru_sdk23.so" ;;
+  24 | 25) RIRU_LIB="libriru_sdk24.so" ;;
+  26 | 27) RIRU_LIB="libriru_sdk26.so" ;;
+  28) RIRU_LIB="libriru_sdk28.so" ;;
+  29) RIRU_LIB="libriru_sdk29.so" ;;
+  30) RIRU_LIB="libriru_sdk30.so" ;;
+esac
+PREVIEW_SDK="$(getprop ro.build.version.preview_sdk)"
+if [ -n "$PREVIEW_SDK" ] && [ "$PREVIEW_SDK" != "0" ]; then
+  RIRU_LIB="libriru.so"
+fi
+ui_print "- Using $RIRU_LIB"
+
+# $1: directory of the libraries in the zip
+extract_riru() {
+  extract "$ZIPFILE" "$1/$RIRU_LIB" "$MODPATH"
+  if [ "$RIRU_LIB" != "libriru.so" ]; then
+    mv "$MODPATH/$1/$RIRU_LIB" "$MODPATH/$1/libriru.so"
+  fi
+}
+
 ui_print "- Extracting Magisk files"
 
 extract "$ZIPFILE" 'module.prop' "$MODPATH"
@@ -52,28 +76,23 @@ extract "$ZIPFILE" 'system.prop' "$MODPATH"
 
 if [ "$ARCH" = "x86" ] || [ "$ARCH" = "x64" ]; then
   ui_print "- Extracting x86 libraries"
-  extract "$ZIPFILE" 'system_x86/lib/libriru.so' "$MODPATH"
-  extract "$ZIPFILE" 'system_x86/lib/libriruhide.so' "$MODPATH"
+  extract_riru 'system_x86/lib'
   extract "$ZIPFILE" 'system_x86/lib/libriruloader.so' "$MODPATH"
-  mv "$MODPATH/system_x86/" "$MODPATH/system/"
 
   if [ "$IS64BIT" = true ]; then
     ui_print "- Extracting x64 libraries"
-    extract "$ZIPFILE" 'system_x86/lib64/libriru.so' "$MODPATH"
-    extract "$ZIPFILE" 'system_x86/lib64/libriruhide.so' "$MODPATH"
+    extract_riru 'system_x86/lib64'
     extract "$ZIPFILE" 'system_x86/lib64/libriruloader.so' "$MODPATH"
-    mv "$MODPATH/system_x86/lib64" "$MODPATH/system/lib64"
   fi
+  mv "$MODPATH/system_x86" "$MODPATH/system"
 else
   ui_print "- Extracting arm libraries"
-  extract "$ZIPFILE" 'system/lib/libriru.so' "$MODPATH"
-  extract "$ZIPFILE" 'system/lib/libriruhide.so' "$MODPATH"
+  extract_riru 'system/lib'
   extract "$ZIPFILE" 'system/lib/libriruloader.so' "$MODPATH"
 
   if [ "$IS64BIT" = true ]; then
     ui_print "- Extracting arm64 libraries"
-    extract "$ZIPFILE" 'system/lib64/libriru.so' "$MODPATH"
-    extract "$ZIPFILE" 'system/lib64/libriruhide.so' "$MODPATH"
+    extract_riru 'system/lib64'
     extract "$ZIPFILE" 'system/lib64/libriruloader.so' "$MODPATH"
   fi
 fi
@@ -92,6 +111,21 @@ extract "$ZIPFILE" "classes.dex" "$RIRU_PATH/bin"
 mv "$RIRU_PATH/bin/classes.dex" "$RIRU_PATH/bin/rirud.dex"
 set_perm "$RIRU_PATH/bin/rirud.dex" 0 0 0700 $SECONTEXT
 
+ui_print "- Extracting tools"
+if [ "$ARCH" = "x86" ] || [ "$ARCH" = "x64" ]; then
+  TOOLS_LIB="system_x86/lib"
+else
+  TOOLS_LIB="system/lib"
+fi
+[ "$IS64BIT" = true ] && TOOLS_LIB="${TOOLS_LIB}64"
+extract "$ZIPFILE" "$TOOLS_LIB/libriruaudit.so" "$RIRU_PATH/bin" true
+mv "$RIRU_PATH/bin/libriruaudit.so" "$RIRU_PATH/bin/riruaudit"
+set_perm "$RIRU_PATH/bin/riruaudit" 0 0 0700 $SECONTEXT
+
+extract "$ZIPFILE" "$TOOLS_LIB/libriruprewarm.so" "$RIRU_PATH/bin" true
+mv "$RIRU_PATH/bin/libriruprewarm.so" "$RIRU_PATH/bin/riruprewarm"
+set_perm "$RIRU_PATH/bin/riruprewarm" 0 0 0700 $SECONTEXT
+
 # write api version to a persist file, only for the check process of the module installation
 ui_print "- Writing Riru files"
 echo -n "$RIRU_API" > "$RIRU_PATH/api_version.new"
@@ -13,4 +13,10 @@ if [ -f "$RIRU_PATH/api_version.new" ]; then
 fi
 
 # Backup ro.dalvik.vm.native.bridge
-echo -n "$(getprop ro.dalvik.vm.native.bridge)" > $RIRU_PATH/native_bridge
\ No newline at end of file
+echo -n "$(getprop ro.dalvik.vm.native.bridge)" > $RIRU_PATH/native_bridge
+
+# Read Riru and module libraries into the page cache before zygote starts, in the background
+# not to hold up the boot, what was cached already is written to prewarm
+if [ -x "$RIRU_PATH/bin/riruprewarm" ]; then
+  "$RIRU_PATH/bin/riruprewarm" > "$RIRU_PATH/prewarm" 2>&1 &
+fi